@@ -0,0 +1,262 @@
+#include "async_logger.h"
+
+#include <log4cplus/helpers/loglog.h>
+#include <boost/bind.hpp>
+#include <sched.h>
+#include <sstream>
+
+using namespace log4cplus;
+using namespace log4cplus::helpers;
+
+namespace slog
+{
+
+const int kSpinsBeforeSleep = 64;
+const int kIdleWaitMillis = 100;
+
+AsyncLogger::AsyncLogger()
+    : policy_(kOverflowBlock)
+    , running_(false)
+    , stopping_(false)
+    , sleeping_(0)
+    , producers_(0)
+    , dropped_(0)
+{
+}
+
+AsyncLogger::~AsyncLogger()
+{
+    Stop();
+}
+
+void AsyncLogger::Start(size_t queueSize, AsyncOverflowPolicy policy)
+{
+    boost::mutex::scoped_lock lock(control_mutex_);
+    StopLocked();
+
+    // Producers never hold a reference to the ring, so it is created once
+    // and kept for the life of the process.
+    if (!ring_)
+    {
+        ring_.reset(new MpscRing<AsyncSlot>(queueSize));
+    }
+    else if (ring_->capacity() < queueSize)
+    {
+        std::stringstream errmsg;
+        errmsg << "AsyncLogger: queue size can't grow once started, keeping "
+            << ring_->capacity() << ".";
+        getLogLog().warn(errmsg.str());
+    }
+
+    policy_ = policy;
+    stopping_ = false;
+    __atomic_store_n(&running_, true, __ATOMIC_SEQ_CST);
+    thread_.reset(new boost::thread(boost::bind(&AsyncLogger::Run, this)));
+}
+
+void AsyncLogger::Stop()
+{
+    boost::mutex::scoped_lock lock(control_mutex_);
+    StopLocked();
+}
+
+// Only one caller at a time gets here, so the thread is joined and the
+// ring drained once.
+void AsyncLogger::StopLocked()
+{
+    if (!thread_)
+    {
+        return;
+    }
+
+    __atomic_store_n(&running_, false, __ATOMIC_SEQ_CST);
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        stopping_ = true;
+        cond_.notify_one();
+    }
+
+    thread_->join();
+    thread_.reset();
+
+    // Producers that saw running_ before it was cleared finish publishing,
+    // what they leave behind is delivered here.
+    while (__atomic_load_n(&producers_, __ATOMIC_SEQ_CST))
+    {
+        sched_yield();
+    }
+
+    while (!ring_->Empty())
+    {
+        AsyncSlot* slot = ring_->Front();
+        slot->event.renderMessage();
+        slot->logger->callAppenders(slot->event);
+        ring_->Pop();
+    }
+    ReportDropped();
+}
+
+// Registers the caller as a producer, Commit() or a NULL return ends it.
+AsyncSlot* AsyncLogger::Claim(size_t* ticket)
+{
+    __atomic_add_fetch(&producers_, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&running_, __ATOMIC_SEQ_CST))
+    {
+        __atomic_sub_fetch(&producers_, 1, __ATOMIC_RELEASE);
+
+        return NULL;
+    }
+
+    AsyncSlot* slot = ring_->TryClaim(ticket);
+    while (NULL == slot)
+    {
+        if (!IsRunning())
+        {
+            __atomic_sub_fetch(&producers_, 1, __ATOMIC_RELEASE);
+
+            return NULL;
+        }
+
+        if (policy_ == kOverflowDrop)
+        {
+            __atomic_add_fetch(&dropped_, 1, __ATOMIC_RELAXED);
+            __atomic_sub_fetch(&producers_, 1, __ATOMIC_RELEASE);
+
+            return NULL;
+        }
+
+        sched_yield();
+        slot = ring_->TryClaim(ticket);
+    }
+
+    return slot;
+}
+
+void AsyncLogger::Commit(size_t ticket)
+{
+    ring_->Publish(ticket);
+    __atomic_sub_fetch(&producers_, 1, __ATOMIC_RELEASE);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sleeping_, __ATOMIC_RELAXED))
+    {
+        Wakeup();
+    }
+}
+
+bool AsyncLogger::Push(log4cplus::spi::LoggerImpl* logger, int level,
+    const std::string& message, const char* file, int line)
+{
+    size_t ticket = 0;
+    AsyncSlot* slot = Claim(&ticket);
+    if (NULL == slot)
+    {
+        return policy_ == kOverflowDrop && IsRunning();
+    }
+
+    slot->logger = logger;
+    slot->event.setLoggingEvent(logger->getName(), level, message, file, line);
+    slot->event.gatherThreadSpecificData();
+    slot->event.detachThreadData();
+    Commit(ticket);
+
+    return true;
+}
+
+bool AsyncLogger::PushDeferred(log4cplus::spi::LoggerImpl* logger, int level,
+    const char* file, int line, const char* format, va_list ap)
+{
+    size_t ticket = 0;
+    AsyncSlot* slot = Claim(&ticket);
+    if (NULL == slot)
+    {
+        return policy_ == kOverflowDrop && IsRunning();
+    }
+
+    slot->logger = logger;
+    slot->event.setDeferredEvent(logger->getName(), level, file, line, 
+        format, ap);
+    slot->event.gatherThreadSpecificData();
+    slot->event.detachThreadData();
+    Commit(ticket);
+
+    return true;
+}
+
+void AsyncLogger::Wakeup()
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    cond_.notify_one();
+}
+
+void AsyncLogger::ReportDropped()
+{
+    size_t dropped = __atomic_exchange_n(&dropped_, 0, __ATOMIC_RELAXED);
+    if (dropped)
+    {
+        std::stringstream errmsg;
+        errmsg << "AsyncLogger: dropped " << dropped
+            << " logs, queue of " << ring_->capacity() << " is full.";
+        getLogLog().error(errmsg.str());
+    }
+}
+
+void AsyncLogger::Run()
+{
+    int spins = 0;
+
+    for (;;)
+    {
+        AsyncSlot* slot = ring_->Front();
+        if (slot)
+        {
+            slot->event.renderMessage();
+            slot->logger->callAppenders(slot->event);
+            ring_->Pop();
+            spins = 0;
+
+            continue;
+        }
+
+        if (!ring_->Empty())
+        {
+            sched_yield();
+
+            continue;
+        }
+
+        ReportDropped();
+
+        if (++spins < kSpinsBeforeSleep)
+        {
+            sched_yield();
+
+            continue;
+        }
+
+        boost::mutex::scoped_lock lock(mutex_);
+        if (stopping_)
+        {
+            break;
+        }
+
+        __atomic_store_n(&sleeping_, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (ring_->Front() == NULL)
+        {
+            cond_.timed_wait(lock,
+                boost::posix_time::milliseconds(kIdleWaitMillis));
+        }
+        __atomic_store_n(&sleeping_, 0, __ATOMIC_RELAXED);
+        spins = 0;
+    }
+}
+
+AsyncLogger& getAsyncLogger()
+{
+    static AsyncLogger asyncLogger;
+
+    return asyncLogger;
+}
+
+} // namespace slog
@@ -0,0 +1,74 @@
+#ifndef ASYNC_LOGGER_H
+#define ASYNC_LOGGER_H
+
+#include <log4cplus/spi/loggerimpl.h>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include "logging_event.h"
+#include "ring_buffer.h"
+
+namespace slog
+{
+
+enum AsyncOverflowPolicy
+{
+    kOverflowBlock = 0,
+    kOverflowDrop = 1,
+};
+
+struct AsyncSlot
+{
+    log4cplus::spi::LoggerImpl* logger;
+    LoggingEvent event;
+};
+
+class AsyncLogger : boost::noncopyable
+{
+public:
+    AsyncLogger();
+    ~AsyncLogger();
+
+    void Start(size_t queueSize, AsyncOverflowPolicy policy);
+    void Stop();
+
+    bool IsRunning() const
+    {
+        return __atomic_load_n(&running_, __ATOMIC_ACQUIRE);
+    }
+
+    bool Push(log4cplus::spi::LoggerImpl* logger, int level,
+        const std::string& message, const char* file, int line);
+    bool PushDeferred(log4cplus::spi::LoggerImpl* logger, int level,
+        const char* file, int line, const char* format, va_list ap);
+
+private:
+    void StopLocked();
+    void Run();
+    void Wakeup();
+    void ReportDropped();
+    AsyncSlot* Claim(size_t* ticket);
+    void Commit(size_t ticket);
+
+private:
+    boost::scoped_ptr<MpscRing<AsyncSlot> > ring_;
+    boost::scoped_ptr<boost::thread> thread_;
+    // Serializes Start() and Stop(), which the watchdog and reconfiguration
+    // may call at the same time.
+    boost::mutex control_mutex_;
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+    AsyncOverflowPolicy policy_;
+    bool running_;
+    bool stopping_;
+    int sleeping_;
+    size_t producers_;
+    size_t dropped_;
+};
+
+AsyncLogger& getAsyncLogger();
+
+} // namespace slog
+
+#endif
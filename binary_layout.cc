@@ -0,0 +1,329 @@
+#include "binary_layout.h"
+
+#include <log4cplus/helpers/loglog.h>
+#include <log4cplus/helpers/property.h>
+#include <log4cplus/helpers/timehelper.h>
+#include <cstring>
+
+using namespace log4cplus;
+using namespace log4cplus::helpers;
+
+namespace slog
+{
+
+namespace
+{
+
+template <typename T>
+static void put(std::string& out, T value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void putString(std::string& out, const char* str, size_t len)
+{
+    if (len > 0xFFFF)
+    {
+        len = 0xFFFF;
+    }
+
+    put<uint16_t>(out, (uint16_t)len);
+    out.append(str, len);
+}
+
+template <typename T>
+static bool get(std::istream& in, T& value)
+{
+    return (bool)in.read(reinterpret_cast<char*>(&value), sizeof(value));
+}
+
+} // namespace
+
+bool BinaryLayout::SiteKey::operator<(const SiteKey& rhs) const
+{
+    if (format != rhs.format)
+    {
+        return format < rhs.format;
+    }
+
+    if (line != rhs.line)
+    {
+        return line < rhs.line;
+    }
+
+    return file < rhs.file;
+}
+
+BinaryLayout::BinaryLayout()
+{
+}
+
+BinaryLayout::BinaryLayout(const helpers::Properties& properties)
+    : Layout(properties)
+{
+}
+
+BinaryLayout::~BinaryLayout()
+{
+}
+
+void BinaryLayout::Dictionary::clear()
+{
+    loggers.clear();
+    threads.clear();
+    sites.clear();
+}
+
+void BinaryLayout::reset()
+{
+    dictionary.clear();
+    buffers.clear();
+}
+
+uint32_t BinaryLayout::defineLogger(std::string& output, Dictionary& dict,
+    const tstring& name)
+{
+    std::map<tstring, uint32_t>::iterator it = dict.loggers.find(name);
+    if (it != dict.loggers.end())
+    {
+        return it->second;
+    }
+
+    uint32_t id = dict.loggers.size();
+    dict.loggers[name] = id;
+
+    put<char>(output, kTagLogger);
+    put<uint32_t>(output, id);
+    putString(output, name.data(), name.size());
+
+    return id;
+}
+
+uint32_t BinaryLayout::defineThread(std::string& output, Dictionary& dict,
+    const tstring& name)
+{
+    std::map<tstring, uint32_t>::iterator it = dict.threads.find(name);
+    if (it != dict.threads.end())
+    {
+        return it->second;
+    }
+
+    uint32_t id = dict.threads.size();
+    dict.threads[name] = id;
+
+    put<char>(output, kTagThread);
+    put<uint32_t>(output, id);
+    putString(output, name.data(), name.size());
+
+    return id;
+}
+
+uint32_t BinaryLayout::defineSite(std::string& output, Dictionary& dict,
+    const spi::InternalLoggingEvent& event, const char* format)
+{
+    SiteKey key;
+    key.format = format;
+    key.line = event.getLine();
+    key.file = event.getFile();
+
+    std::map<SiteKey, uint32_t>::iterator it = dict.sites.find(key);
+    if (it != dict.sites.end())
+    {
+        return it->second;
+    }
+
+    uint32_t id = dict.sites.size();
+    dict.sites[key] = id;
+
+    put<char>(output, kTagSite);
+    put<uint32_t>(output, id);
+    put<int32_t>(output, key.line);
+    putString(output, key.file.data(), key.file.size());
+    put<uint8_t>(output, format ? 1 : 0);
+    putString(output, format ? format : "", format ? strlen(format) : 0);
+
+    return id;
+}
+
+void BinaryLayout::append(std::string& output, Dictionary& dict,
+    const spi::InternalLoggingEvent& event)
+{
+    const LoggingEvent* sev = dynamic_cast<const LoggingEvent*>(&event);
+    const BinaryRecord* args = (sev && !sev->record().empty()) ?
+        &sev->record() : NULL;
+
+    uint32_t logger = defineLogger(output, dict, event.getLoggerName());
+    uint32_t thread = defineThread(output, dict, event.getThread());
+    uint32_t site = defineSite(output, dict, event, 
+        args ? args->format() : NULL);
+
+    const Time& ts = event.getTimestamp();
+    put<char>(output, args ? kTagEvent : kTagMessage);
+    put<int64_t>(output, ts.sec());
+    put<int32_t>(output, ts.usec());
+    put<int32_t>(output, event.getLogLevel());
+    put<uint32_t>(output, logger);
+    put<uint32_t>(output, thread);
+    put<uint32_t>(output, site);
+
+    if (args)
+    {
+        uint16_t len = (uint16_t)args->size();
+        put<uint16_t>(output, args->truncated() ? (len | kArgsTruncated) : len);
+        output.append(args->data(), args->size());
+    }
+    else
+    {
+        const tstring& msg = event.getMessage();
+        put<uint32_t>(output, (uint32_t)msg.size());
+        output.append(msg.data(), msg.size());
+    }
+}
+
+void BinaryLayout::formatAndAppend(tostream& output,
+    const spi::InternalLoggingEvent& event)
+{
+    record.clear();
+    append(record, dictionary, event);
+    output.write(record.data(), record.size());
+}
+
+void BinaryLayout::formatAndAppend(std::string& output,
+    const spi::InternalLoggingEvent& event)
+{
+    Dictionary& dict = buffers[&output];
+    if (output.empty())
+    {
+        dict.clear();
+    }
+
+    append(output, dict, event);
+}
+
+BinaryLogReader::BinaryLogReader()
+    : input_(NULL)
+{
+}
+
+void BinaryLogReader::Open(std::istream* input)
+{
+    input_ = input;
+}
+
+bool BinaryLogReader::ReadString(std::string& str)
+{
+    uint16_t len = 0;
+    if (!get(*input_, len))
+    {
+        return false;
+    }
+
+    str.resize(len);
+
+    return len == 0 || (bool)input_->read(&str[0], len);
+}
+
+bool BinaryLogReader::Next(LoggingEvent& event)
+{
+    char tag = 0;
+    while (input_ && get(*input_, tag))
+    {
+        uint32_t id = 0;
+        switch (tag)
+        {
+        case kTagLogger:
+            if (!get(*input_, id) || !ReadString(loggers_[id]))
+            {
+                return false;
+            }
+            break;
+
+        case kTagThread:
+            if (!get(*input_, id) || !ReadString(threads_[id]))
+            {
+                return false;
+            }
+            break;
+
+        case kTagSite:
+            {
+                Site site;
+                uint8_t hasFormat = 0;
+                if (!get(*input_, id) || !get(*input_, site.line)
+                    || !ReadString(site.file) || !get(*input_, hasFormat)
+                    || !ReadString(site.format))
+                {
+                    return false;
+                }
+                sites_[id] = site;
+            }
+            break;
+
+        case kTagEvent:
+        case kTagMessage:
+            {
+                int64_t sec = 0;
+                int32_t usec = 0;
+                int32_t level = 0;
+                uint32_t logger = 0;
+                uint32_t thread = 0;
+                uint32_t site = 0;
+                if (!get(*input_, sec) || !get(*input_, usec)
+                    || !get(*input_, level) || !get(*input_, logger)
+                    || !get(*input_, thread) || !get(*input_, site))
+                {
+                    return false;
+                }
+
+                uint32_t len = 0;
+                bool truncated = false;
+                if (tag == kTagEvent)
+                {
+                    uint16_t argsLen = 0;
+                    if (!get(*input_, argsLen))
+                    {
+                        return false;
+                    }
+                    truncated = (argsLen & kArgsTruncated) != 0;
+                    len = argsLen & ~kArgsTruncated;
+                }
+                else if (!get(*input_, len))
+                {
+                    return false;
+                }
+
+                args_.resize(len);
+                if (len && !input_->read(&args_[0], len))
+                {
+                    return false;
+                }
+
+                const Site& s = sites_[site];
+                if (tag == kTagEvent)
+                {
+                    event.setDecodedEvent(loggers_[logger], level,
+                        s.file.c_str(), s.line, s.format.c_str(),
+                        len ? &args_[0] : NULL, len, truncated);
+                }
+                else
+                {
+                    message_.assign(len ? &args_[0] : "", len);
+                    event.setLoggingEvent(loggers_[logger], level, message_,
+                        s.file.c_str(), s.line);
+                }
+                event.setOrigin(threads_[thread], Time(sec, usec));
+
+                return true;
+            }
+
+        default:
+            getLogLog().error(LOG4CPLUS_TEXT("BinaryLogReader: bad record tag"));
+
+            return false;
+        }
+    }
+
+    return false;
+}
+
+} // namespace slog
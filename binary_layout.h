@@ -0,0 +1,117 @@
+#ifndef BINARY_LAYOUT_H
+#define BINARY_LAYOUT_H
+
+#include <log4cplus/layout.h>
+#include <stdint.h>
+#include <istream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "logging_event.h"
+
+namespace slog
+{
+
+// Record tags of the binary log format. Integers are in host byte order,
+// strings are a uint16 length followed by the bytes, a message a uint32
+// length, captured arguments a uint16 length whose top bit marks a
+// truncated capture. Loggers, threads and call sites are defined before
+// their first use in every chunk an appender buffer flushes, so each
+// chunk decodes on its own.
+enum BinaryRecordTag
+{
+    kTagLogger = 'L',
+    kTagThread = 'T',
+    kTagSite = 'S',
+    kTagEvent = 'E',
+    kTagMessage = 'M',
+};
+
+const uint16_t kArgsTruncated = 0x8000;
+
+class BinaryLayout : public log4cplus::Layout
+{
+public:
+    BinaryLayout();
+    BinaryLayout(const log4cplus::helpers::Properties& properties);
+    virtual ~BinaryLayout();
+
+    virtual void formatAndAppend(log4cplus::tostream& output,
+        const log4cplus::spi::InternalLoggingEvent& event);
+
+    // Appends to a file appender buffer. Definitions are tracked per
+    // buffer and start over whenever the buffer is empty.
+    void formatAndAppend(std::string& output,
+        const log4cplus::spi::InternalLoggingEvent& event);
+
+    void reset();
+
+private:
+    struct SiteKey
+    {
+        const char* format;
+        int line;
+        log4cplus::tstring file;
+
+        bool operator<(const SiteKey& rhs) const;
+    };
+
+    struct Dictionary
+    {
+        std::map<log4cplus::tstring, uint32_t> loggers;
+        std::map<log4cplus::tstring, uint32_t> threads;
+        std::map<SiteKey, uint32_t> sites;
+
+        void clear();
+    };
+
+    void append(std::string& output, Dictionary& dict,
+        const log4cplus::spi::InternalLoggingEvent& event);
+    uint32_t defineLogger(std::string& output, Dictionary& dict,
+        const log4cplus::tstring& name);
+    uint32_t defineThread(std::string& output, Dictionary& dict,
+        const log4cplus::tstring& name);
+    uint32_t defineSite(std::string& output, Dictionary& dict,
+        const log4cplus::spi::InternalLoggingEvent& event, const char* format);
+
+    Dictionary dictionary;
+    std::map<const std::string*, Dictionary> buffers;
+    std::string record;
+
+private:
+    BinaryLayout(const BinaryLayout&);
+    BinaryLayout& operator=(const BinaryLayout&);
+};
+
+// Reads back what BinaryLayout wrote. Definitions persist across Open()
+// calls so rotated files can be decoded oldest first.
+class BinaryLogReader
+{
+public:
+    BinaryLogReader();
+
+    void Open(std::istream* input);
+    bool Next(LoggingEvent& event);
+
+private:
+    struct Site
+    {
+        std::string file;
+        std::string format;
+        int line;
+    };
+
+    bool ReadString(std::string& str);
+
+    std::istream* input_;
+    std::map<uint32_t, std::string> loggers_;
+    std::map<uint32_t, std::string> threads_;
+    std::map<uint32_t, Site> sites_;
+    std::vector<char> args_;
+    std::string message_;
+};
+
+} // namespace slog
+
+#endif
@@ -0,0 +1,562 @@
+#include "binary_record.h"
+
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+
+namespace slog
+{
+
+namespace
+{
+
+enum ArgType
+{
+    kArgNone,
+    kArgInt,
+    kArgLong,
+    kArgLongLong,
+    kArgSize,
+    kArgDouble,
+    kArgLongDouble,
+    kArgString,
+    kArgWideChar,
+    kArgWideString,
+    kArgPointer,
+    kArgSkip,
+};
+
+struct FormatSpec
+{
+    const char* begin;
+    const char* end;
+    bool starWidth;
+    bool starPrecision;
+    int precision;
+    ArgType type;
+};
+
+// Scans from a '%' to the end of its conversion, *end is past the
+// conversion character. Returns false for "%%" and unterminated specs.
+static bool parseSpec(const char* p, FormatSpec* spec)
+{
+    spec->begin = p++;
+    spec->starWidth = false;
+    spec->starPrecision = false;
+    spec->precision = -1;
+    spec->type = kArgNone;
+
+    while (*p && strchr("-+ #0'", *p))
+    {
+        p++;
+    }
+
+    if (*p == '*')
+    {
+        spec->starWidth = true;
+        p++;
+    }
+
+    while (*p >= '0' && *p <= '9')
+    {
+        p++;
+    }
+
+    if (*p == '.')
+    {
+        p++;
+        spec->precision = 0;
+        if (*p == '*')
+        {
+            spec->starPrecision = true;
+            p++;
+        }
+
+        while (*p >= '0' && *p <= '9')
+        {
+            spec->precision = spec->precision * 10 + (*p - '0');
+            p++;
+        }
+    }
+
+    int longs = 0;
+    bool isSize = false;
+    bool isLongDouble = false;
+    for (; *p && strchr("hlLqjzt", *p); p++)
+    {
+        if (*p == 'l' || *p == 'q')
+        {
+            longs += (*p == 'q') ? 2 : 1;
+        }
+        else if (*p == 'L')
+        {
+            isLongDouble = true;
+        }
+        else if (*p == 'j' || *p == 'z' || *p == 't')
+        {
+            isSize = true;
+        }
+    }
+
+    switch (*p)
+    {
+    case 'c':
+        spec->type = longs ? kArgWideChar : kArgInt;
+        break;
+
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+        if (isSize)
+        {
+            spec->type = kArgSize;
+        }
+        else
+        {
+            // glibc takes L on an integer as ll.
+            spec->type = (longs >= 2 || isLongDouble) ? kArgLongLong 
+                : (longs ? kArgLong : kArgInt);
+        }
+        break;
+
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+        spec->type = isLongDouble ? kArgLongDouble : kArgDouble;
+        break;
+
+    case 's':
+        spec->type = longs ? kArgWideString : kArgString;
+        break;
+
+    case 'p':
+        spec->type = kArgPointer;
+        break;
+
+    case 'n':
+        spec->type = kArgSkip;
+        break;
+
+    default:
+        spec->end = *p ? p + 1 : p;
+
+        return false;
+    }
+
+    spec->end = p + 1;
+
+    return true;
+}
+
+template <typename T>
+static bool put(char* data, size_t& size, T value)
+{
+    if (size + sizeof(value) > BinaryRecord::kMaxSize)
+    {
+        return false;
+    }
+
+    memcpy(data + size, &value, sizeof(value));
+    size += sizeof(value);
+
+    return true;
+}
+
+template <typename T>
+static T get(const char* data, size_t& offset)
+{
+    T value;
+    memcpy(&value, data + offset, sizeof(value));
+    offset += sizeof(value);
+
+    return value;
+}
+
+static void appendFormatted(std::string& out, const char* spec, ...)
+{
+    char buf[256];
+    va_list ap;
+
+    va_start(ap, spec);
+    int n = vsnprintf(buf, sizeof(buf), spec, ap);
+    va_end(ap);
+
+    if (n < 0)
+    {
+        return;
+    }
+
+    if ((size_t)n < sizeof(buf))
+    {
+        out.append(buf, n);
+
+        return;
+    }
+
+    std::string big(n + 1, '\0');
+    va_start(ap, spec);
+    vsnprintf(&big[0], big.size(), spec, ap);
+    va_end(ap);
+    out.append(big.data(), n);
+}
+
+template <typename T>
+static void appendSpec(std::string& out, const std::string& fmt,
+    const int* args, int nargs, T value)
+{
+    if (nargs == 0)
+    {
+        appendFormatted(out, fmt.c_str(), value);
+    }
+    else if (nargs == 1)
+    {
+        appendFormatted(out, fmt.c_str(), args[0], value);
+    }
+    else
+    {
+        appendFormatted(out, fmt.c_str(), args[0], args[1], value);
+    }
+}
+
+static size_t argSize(ArgType type)
+{
+    switch (type)
+    {
+    case kArgInt:
+    case kArgWideChar:
+        return 4;
+
+    case kArgString:
+    case kArgWideString:
+        return 2;
+
+    case kArgLongDouble:
+        return sizeof(long double);
+
+    case kArgNone:
+    case kArgSkip:
+        return 0;
+
+    default:
+        return 8;
+    }
+}
+
+} // namespace
+
+void BinaryRecord::Capture(const char* format, va_list ap)
+{
+    format_ = format;
+    size_ = 0;
+    truncated_ = false;
+
+    FormatSpec spec;
+    for (const char* p = strchr(format, '%'); p; p = strchr(p, '%'))
+    {
+        if (!parseSpec(p, &spec))
+        {
+            p = spec.end;
+
+            continue;
+        }
+        p = spec.end;
+
+        bool ok = true;
+        if (spec.starWidth)
+        {
+            ok = put<int32_t>(data_, size_, va_arg(ap, int));
+        }
+        if (ok && spec.starPrecision)
+        {
+            // A negative precision counts as none.
+            spec.precision = va_arg(ap, int);
+            ok = put<int32_t>(data_, size_, spec.precision);
+        }
+
+        switch (spec.type)
+        {
+        case kArgInt:
+            ok = ok && put<int32_t>(data_, size_, va_arg(ap, int));
+            break;
+
+        case kArgLong:
+            ok = ok && put<int64_t>(data_, size_, va_arg(ap, long));
+            break;
+
+        case kArgLongLong:
+            ok = ok && put<int64_t>(data_, size_, va_arg(ap, long long));
+            break;
+
+        case kArgSize:
+            ok = ok && put<int64_t>(data_, size_, va_arg(ap, size_t));
+            break;
+
+        case kArgDouble:
+            ok = ok && put<double>(data_, size_, va_arg(ap, double));
+            break;
+
+        case kArgLongDouble:
+            ok = ok && put<long double>(data_, size_, va_arg(ap, long double));
+            break;
+
+        case kArgPointer:
+            ok = ok && put<uint64_t>(data_, size_,
+                (uintptr_t)va_arg(ap, void*));
+            break;
+
+        case kArgSkip:
+            va_arg(ap, void*);
+            break;
+
+        case kArgWideChar:
+            ok = ok && put<int32_t>(data_, size_, va_arg(ap, wint_t));
+            break;
+
+        case kArgWideString:
+            {
+                const wchar_t* str = va_arg(ap, const wchar_t*);
+                if (NULL == str)
+                {
+                    str = L"(null)";
+                }
+
+                // Every character takes at least one byte of output, so
+                // the precision also bounds the characters needed.
+                size_t len = (spec.precision >= 0) 
+                    ? wcsnlen(str, spec.precision) : wcslen(str);
+                size_t room = (kMaxSize - size_) / sizeof(wchar_t);
+                if (ok && room > 0)
+                {
+                    room--;
+                    if (len > room)
+                    {
+                        len = room;
+                        truncated_ = true;
+                    }
+                    put<uint16_t>(data_, size_, (uint16_t)len);
+                    memcpy(data_ + size_, str, len * sizeof(wchar_t));
+                    size_ += len * sizeof(wchar_t);
+                }
+                else
+                {
+                    ok = false;
+                }
+            }
+            break;
+
+        case kArgString:
+            {
+                const char* str = va_arg(ap, const char*);
+                if (NULL == str)
+                {
+                    str = "(null)";
+                }
+
+                // With a precision the argument needn't be terminated.
+                size_t len = (spec.precision >= 0) 
+                    ? strnlen(str, spec.precision) : strlen(str);
+                size_t room = kMaxSize - size_;
+                if (ok && room > sizeof(uint16_t))
+                {
+                    room -= sizeof(uint16_t);
+                    if (len > room)
+                    {
+                        len = room;
+                        truncated_ = true;
+                    }
+                    put<uint16_t>(data_, size_, (uint16_t)len);
+                    memcpy(data_ + size_, str, len);
+                    size_ += len;
+                }
+                else
+                {
+                    ok = false;
+                }
+            }
+            break;
+
+        default:
+            break;
+        }
+
+        if (!ok)
+        {
+            truncated_ = true;
+
+            return;
+        }
+    }
+}
+
+bool BinaryRecord::Assign(const char* format, const char* data, size_t size,
+    bool truncated)
+{
+    Clear();
+    if (size > kMaxSize)
+    {
+        return false;
+    }
+
+    format_ = format;
+    size_ = size;
+    truncated_ = truncated;
+    if (size)
+    {
+        memcpy(data_, data, size);
+    }
+
+    return true;
+}
+
+void BinaryRecord::Render(std::string& out) const
+{
+    if (NULL == format_)
+    {
+        return;
+    }
+
+    size_t offset = 0;
+    FormatSpec spec;
+    const char* p = format_;
+    while (*p)
+    {
+        const char* next = strchr(p, '%');
+        if (NULL == next)
+        {
+            out.append(p);
+
+            break;
+        }
+
+        out.append(p, next - p);
+        if (!parseSpec(next, &spec))
+        {
+            if (next[1] == '%')
+            {
+                out += '%';
+            }
+            else
+            {
+                out.append(next, spec.end - next);
+            }
+            p = spec.end;
+
+            continue;
+        }
+        p = spec.end;
+
+        if (spec.type == kArgSkip)
+        {
+            continue;
+        }
+
+        int args[2];
+        int nargs = 0;
+        size_t need = argSize(spec.type) 
+            + (spec.starWidth ? 4 : 0) + (spec.starPrecision ? 4 : 0);
+        if (offset + need > size_)
+        {
+            out.append("<truncated>");
+
+            break;
+        }
+
+        if (spec.starWidth)
+        {
+            args[nargs++] = get<int32_t>(data_, offset);
+        }
+        if (spec.starPrecision)
+        {
+            args[nargs++] = get<int32_t>(data_, offset);
+        }
+
+        // The spec is handed to snprintf as written, so h and hh still
+        // truncate and flags apply to %p. Only the 64 bit integers, captured
+        // from long, size_t and the like, get their modifier replaced.
+        std::string fmt(spec.begin, spec.end - spec.begin);
+        char conv = fmt[fmt.size() - 1];
+
+        switch (spec.type)
+        {
+        case kArgString:
+            {
+                size_t len = get<uint16_t>(data_, offset);
+                if (offset + len > size_)
+                {
+                    len = size_ - offset;
+                }
+
+                std::string str(data_ + offset, len);
+                offset += len;
+                if (nargs == 0 && fmt == "%s")
+                {
+                    out.append(str);
+                }
+                else
+                {
+                    appendSpec(out, fmt, args, nargs, str.c_str());
+                }
+            }
+            break;
+
+        case kArgWideString:
+            {
+                size_t len = get<uint16_t>(data_, offset);
+                if (offset + len * sizeof(wchar_t) > size_)
+                {
+                    len = (size_ - offset) / sizeof(wchar_t);
+                }
+
+                std::wstring str(len, L'\0');
+                memcpy(&str[0], data_ + offset, len * sizeof(wchar_t));
+                offset += len * sizeof(wchar_t);
+                appendSpec(out, fmt, args, nargs, str.c_str());
+            }
+            break;
+
+        case kArgWideChar:
+            appendSpec(out, fmt, args, nargs, (wint_t)get<int32_t>(data_, offset));
+            break;
+
+        case kArgDouble:
+            appendSpec(out, fmt, args, nargs, get<double>(data_, offset));
+            break;
+
+        case kArgLongDouble:
+            appendSpec(out, fmt, args, nargs, get<long double>(data_, offset));
+            break;
+
+        case kArgPointer:
+            appendSpec(out, fmt, args, nargs, 
+                (void*)(uintptr_t)get<uint64_t>(data_, offset));
+            break;
+
+        case kArgInt:
+            {
+                int32_t value = get<int32_t>(data_, offset);
+                if (conv == 'c' || conv == 'd' || conv == 'i')
+                {
+                    appendSpec(out, fmt, args, nargs, (int)value);
+                }
+                else
+                {
+                    appendSpec(out, fmt, args, nargs, (unsigned)value);
+                }
+            }
+            break;
+
+        default:
+            {
+                int64_t value = get<int64_t>(data_, offset);
+                std::string::size_type mod = fmt.find_first_of("hlLqjzt");
+                fmt.replace(mod, fmt.size() - 1 - mod, "ll");
+                appendSpec(out, fmt, args, nargs, (long long)value);
+            }
+            break;
+        }
+    }
+
+    if (truncated_)
+    {
+        out.append("...");
+    }
+}
+
+} // namespace slog
@@ -0,0 +1,72 @@
+#ifndef BINARY_RECORD_H
+#define BINARY_RECORD_H
+
+#include <stdarg.h>
+#include <cstddef>
+#include <string>
+
+namespace slog
+{
+
+// Arguments of a printf style statement, captured as raw values next to the
+// format string pointer. The format is parsed only to learn the argument
+// types, the text is produced later by Render().
+class BinaryRecord
+{
+public:
+    BinaryRecord()
+        : format_(NULL)
+        , size_(0)
+        , truncated_(false)
+    {
+    }
+
+    void Clear()
+    {
+        format_ = NULL;
+        size_ = 0;
+        truncated_ = false;
+    }
+
+    bool empty() const
+    {
+        return NULL == format_;
+    }
+
+    const char* format() const
+    {
+        return format_;
+    }
+
+    const char* data() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool truncated() const
+    {
+        return truncated_;
+    }
+
+    void Capture(const char* format, va_list ap);
+    bool Assign(const char* format, const char* data, size_t size,
+        bool truncated);
+    void Render(std::string& out) const;
+
+    static const size_t kMaxSize = 512;
+
+private:
+    const char* format_;
+    size_t size_;
+    bool truncated_;
+    char data_[kMaxSize];
+};
+
+} // namespace slog
+
+#endif
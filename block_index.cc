@@ -0,0 +1,28 @@
+#include "block_index.h"
+
+#include <fstream>
+
+namespace slog
+{
+
+const char* const kBlockIndexSuffix = ".idx";
+
+bool readBlockIndex(const std::string& path, 
+    std::vector<BlockIndexEntry>& entries)
+{
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+    if (!in)
+    {
+        return false;
+    }
+
+    BlockIndexEntry entry;
+    while (in.read(reinterpret_cast<char*>(&entry), sizeof(entry)))
+    {
+        entries.push_back(entry);
+    }
+
+    return true;
+}
+
+} // namespace slog
@@ -0,0 +1,32 @@
+#ifndef BLOCK_INDEX_H
+#define BLOCK_INDEX_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace slog
+{
+
+// Appended to the log file name for its sidecar index.
+extern const char* const kBlockIndexSuffix;
+
+// One record of a sidecar index, in host byte order. Every block of a
+// compressed log file (a gzip member, zstd or lz4 frame) decodes on its
+// own; first and last are the earliest and latest log times in it, in
+// microseconds since the epoch.
+struct BlockIndexEntry
+{
+    uint64_t offset;
+    uint64_t length;
+    int64_t first;
+    int64_t last;
+};
+
+// Reads every complete record of an index, false if it can't be opened.
+bool readBlockIndex(const std::string& path, 
+    std::vector<BlockIndexEntry>& entries);
+
+} // namespace slog
+
+#endif
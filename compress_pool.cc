@@ -0,0 +1,426 @@
+#include "compress_pool.h"
+
+#include <log4cplus/helpers/loglog.h>
+#include <boost/bind.hpp>
+#include <cstring>
+#include <sstream>
+
+using namespace log4cplus;
+using namespace log4cplus::helpers;
+
+namespace slog
+{
+
+// Chunks a strand may hold before Submit() waits for the worker.
+static const size_t kMaxQueuedJobs = 8;
+
+// Members a parallel compressor may have cut but not yet written.
+static const size_t kMaxOrderedMembers = 16;
+
+// Tasks waiting for a worker before Schedule() blocks.
+static const size_t kMaxReadyTasks = 256;
+
+static void reportError(int ret, size_t logs)
+{
+    if (ret >= 0)
+    {
+        return;
+    }
+
+    std::stringstream errmsg;
+    errmsg << "Dropped " << logs << " logs. ";
+    if (ret == -1)
+    {
+        errmsg << "Write: " << strerror(errno);
+    }
+    else
+    {
+        errmsg << "Compression: " << zError(ret);
+    }
+    getLogLog().error(errmsg.str());
+}
+
+CompressStrand::CompressStrand(size_t max, size_t real_flush, int level)
+    : scheduled_(false)
+    , gz_(max, real_flush, level)
+{
+}
+
+CompressStrand::~CompressStrand()
+{
+    Drain();
+
+    for (size_t i = 0; i < spare_.size(); i++)
+    {
+        delete spare_[i];
+    }
+}
+
+void CompressStrand::Submit(std::string& data, size_t logs,
+    const Time& first, const Time& last, const LogFilePtr& file, bool force)
+{
+    bool schedule = false;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        while (jobs_.size() >= kMaxQueuedJobs)
+        {
+            space_.wait(lock);
+        }
+
+        Job* job = NULL;
+        if (spare_.empty())
+        {
+            // The swap below hands this string to the caller's buffer.
+            job = new Job();
+            job->data.reserve(data.capacity());
+        }
+        else
+        {
+            job = spare_.back();
+            spare_.pop_back();
+        }
+
+        job->data.swap(data);
+        job->logs = logs;
+        job->first = first;
+        job->last = last;
+        job->file = file;
+        job->force = force;
+        jobs_.push_back(job);
+
+        schedule = !scheduled_;
+        scheduled_ = true;
+    }
+
+    if (schedule)
+    {
+        getCompressPool().Schedule(this);
+    }
+}
+
+void CompressStrand::Drain()
+{
+    std::string empty;
+    Submit(empty, 0, Time(), Time(), LogFilePtr(), true);
+
+    boost::mutex::scoped_lock lock(mutex_);
+    while (scheduled_)
+    {
+        drained_.wait(lock);
+    }
+}
+
+void CompressStrand::Run()
+{
+    while (true)
+    {
+        Job* job = NULL;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (jobs_.empty())
+            {
+                scheduled_ = false;
+                drained_.notify_all();
+
+                return;
+            }
+
+            job = jobs_.front();
+            jobs_.pop_front();
+            space_.notify_all();
+        }
+
+        Process(job);
+
+        boost::mutex::scoped_lock lock(mutex_);
+        job->data.clear();
+        job->file.reset();
+        spare_.push_back(job);
+    }
+}
+
+void CompressStrand::Process(Job* job)
+{
+    // A gzip member never spans files, finish the one open in the old file
+    // before starting on the new one.
+    if (gz_.file() && job->file && gz_.file() != job->file)
+    {
+        Flush(true);
+    }
+
+    if (job->file)
+    {
+        gz_.setfile(0, job->file);
+    }
+
+    if (!gz_.file())
+    {
+        return;
+    }
+
+    gz_.data().swap(job->data);
+    gz_.AddLogs(job->logs, job->first, job->last);
+    Flush(job->force);
+}
+
+void CompressStrand::Flush(bool force)
+{
+    LogFilePtr file = gz_.file();
+    size_t logs = gz_.GetLogCount();
+    int ret = gz_.Flush(force);
+    reportError(ret, logs);
+    if (ret == -1)
+    {
+        file->SetFailed();
+    }
+}
+
+ParallelCompressor::ParallelCompressor(size_t real_flush, int level)
+    : pending_(NULL)
+    , writing_(false)
+    , real_flush_(real_flush)
+    , level_(level)
+{
+}
+
+ParallelCompressor::~ParallelCompressor()
+{
+    Drain();
+
+    for (size_t i = 0; i < spare_.size(); i++)
+    {
+        delete spare_[i];
+    }
+}
+
+// Called with mutex_ held, queues the pending member for writing. A member
+// without input is recycled, it would only add an empty gzip member.
+ParallelCompressor::Member* ParallelCompressor::Cut()
+{
+    Member* member = pending_;
+    pending_ = NULL;
+    if (member->input.empty())
+    {
+        member->file.reset();
+        spare_.push_back(member);
+
+        return NULL;
+    }
+    ordered_.push_back(member);
+
+    return member;
+}
+
+void ParallelCompressor::Submit(std::string& data, size_t logs,
+    const Time& first, const Time& last, const LogFilePtr& file, bool force)
+{
+    Member* ready[2] = { NULL, NULL };
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        while (ordered_.size() >= kMaxOrderedMembers)
+        {
+            space_.wait(lock);
+        }
+
+        if (pending_ && file && pending_->file != file)
+        {
+            ready[0] = Cut();
+        }
+
+        if (!pending_ && file)
+        {
+            if (spare_.empty())
+            {
+                pending_ = new Member();
+                pending_->owner = this;
+            }
+            else
+            {
+                pending_ = spare_.back();
+                spare_.pop_back();
+            }
+
+            pending_->logs = 0;
+            pending_->file = file;
+            pending_->error = 0;
+            pending_->done = false;
+        }
+
+        if (pending_)
+        {
+            if (logs && (pending_->logs == 0 || first < pending_->first))
+            {
+                pending_->first = first;
+            }
+
+            if (logs && (pending_->logs == 0 || pending_->last < last))
+            {
+                pending_->last = last;
+            }
+            pending_->input.append(data);
+            pending_->logs += logs;
+            if (force || pending_->input.size() >= real_flush_)
+            {
+                ready[1] = Cut();
+            }
+        }
+    }
+    data.clear();
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (ready[i])
+        {
+            getCompressPool().Schedule(ready[i]);
+        }
+    }
+}
+
+void ParallelCompressor::Drain()
+{
+    std::string empty;
+    Submit(empty, 0, Time(), Time(), LogFilePtr(), true);
+
+    // The last members may still be being written.
+    boost::mutex::scoped_lock lock(mutex_);
+    while (!ordered_.empty() || writing_)
+    {
+        drained_.wait(lock);
+    }
+}
+
+void ParallelCompressor::Member::Run()
+{
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    error = ::deflateInit2(&strm, owner->level_, 
+        Z_DEFLATED, 15|16, 8, Z_DEFAULT_STRATEGY);
+    if (error == Z_OK)
+    {
+        output.resize(::deflateBound(&strm, input.size()));
+        strm.next_in = (Bytef*)input.data();
+        strm.avail_in = input.size();
+        strm.next_out = (Bytef*)&output[0];
+        strm.avail_out = output.size();
+
+        error = ::deflate(&strm, Z_FINISH);
+        output.resize(strm.total_out);
+        error = (error == Z_STREAM_END) ? Z_OK : error;
+        ::deflateEnd(&strm);
+    }
+
+    owner->Complete(this);
+}
+
+// Workers only mark their member done. Whoever finds the head of the queue
+// done becomes the writer and writes finished heads until none is left,
+// members completing meanwhile are left to it, so blocks reach the file in
+// order without workers waiting for each other.
+void ParallelCompressor::Complete(Member* member)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    member->done = true;
+    if (writing_ || !ordered_.front()->done)
+    {
+        return;
+    }
+
+    writing_ = true;
+    std::vector<Member*> finished;
+    while (!ordered_.empty() && ordered_.front()->done)
+    {
+        while (!ordered_.empty() && ordered_.front()->done)
+        {
+            finished.push_back(ordered_.front());
+            ordered_.pop_front();
+        }
+        space_.notify_all();
+        lock.unlock();
+
+        for (size_t i = 0; i < finished.size(); i++)
+        {
+            Member* m = finished[i];
+            if (m->error != Z_OK)
+            {
+                reportError(m->error, m->logs);
+            }
+            else if (m->file->WriteBlock(m->output.data(), m->output.size(), 
+                m->first, m->last) < 0)
+            {
+                reportError(-1, m->logs);
+                m->file->SetFailed();
+            }
+            m->input.clear();
+            m->output.clear();
+            m->file.reset();
+        }
+
+        lock.lock();
+        spare_.insert(spare_.end(), finished.begin(), finished.end());
+        finished.clear();
+    }
+    writing_ = false;
+
+    if (ordered_.empty())
+    {
+        drained_.notify_all();
+    }
+}
+
+CompressPool::CompressPool()
+    : size_(0)
+{
+}
+
+void CompressPool::Start(size_t threads)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    for (; size_ < threads; size_++)
+    {
+        threads_.create_thread(boost::bind(&CompressPool::Run, this));
+    }
+}
+
+// Workers never schedule, so waiting here cannot stall the pool.
+void CompressPool::Schedule(CompressTask* task)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    while (ready_.size() >= kMaxReadyTasks)
+    {
+        space_.wait(lock);
+    }
+
+    ready_.push_back(task);
+    cond_.notify_one();
+}
+
+void CompressPool::Run()
+{
+    while (true)
+    {
+        CompressTask* task = NULL;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            while (ready_.empty())
+            {
+                cond_.wait(lock);
+            }
+
+            task = ready_.front();
+            ready_.pop_front();
+            space_.notify_one();
+        }
+
+        task->Run();
+    }
+}
+
+// Never destroyed, appenders may be closed by static destructors.
+CompressPool& getCompressPool()
+{
+    static CompressPool* pool = new CompressPool();
+
+    return *pool;
+}
+
+} // namespace slog
@@ -0,0 +1,156 @@
+#ifndef COMPRESS_POOL_H
+#define COMPRESS_POOL_H
+
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "file_appender.h"
+
+namespace slog
+{
+
+class CompressTask
+{
+public:
+    virtual ~CompressTask() 
+    {
+    }
+
+    virtual void Run() = 0;
+};
+
+// Backend of an AsyncGzLogBuffer.
+class ChunkCompressor : boost::noncopyable
+{
+public:
+    virtual ~ChunkCompressor() 
+    {
+    }
+
+    // Takes the content of data and leaves it empty.
+    virtual void Submit(std::string& data, size_t logs, 
+        const log4cplus::helpers::Time& first, 
+        const log4cplus::helpers::Time& last, 
+        const LogFilePtr& file, bool force) = 0;
+
+    // Finishes the open gzip member and waits until everything queued
+    // has been written.
+    virtual void Drain() = 0;
+};
+
+// Chunks of one buffer feed a single deflate stream. They run on at most
+// one pool worker at a time, so they are deflated and written in
+// submission order. Submit() blocks while kMaxQueuedJobs chunks wait.
+class CompressStrand : public ChunkCompressor, public CompressTask
+{
+public:
+    CompressStrand(size_t max, size_t real_flush, int level);
+    virtual ~CompressStrand();
+
+    virtual void Submit(std::string& data, size_t logs, 
+        const log4cplus::helpers::Time& first, 
+        const log4cplus::helpers::Time& last, 
+        const LogFilePtr& file, bool force);
+    virtual void Drain();
+    virtual void Run();
+
+private:
+    struct Job
+    {
+        std::string data;
+        size_t logs;
+        log4cplus::helpers::Time first;
+        log4cplus::helpers::Time last;
+        LogFilePtr file;
+        bool force;
+    };
+
+    void Process(Job* job);
+    void Flush(bool force);
+
+    boost::mutex mutex_;
+    boost::condition_variable drained_;
+    boost::condition_variable space_;
+    std::deque<Job*> jobs_;
+    std::vector<Job*> spare_;
+    bool scheduled_;
+
+    // Only touched by the worker running the strand.
+    GzLogBuffer gz_;
+};
+
+// Every real_flush bytes of input become an independent gzip member that
+// any worker may compress. Members are written in the order they were
+// cut, the file is a valid concatenation of gzip members. Submit() blocks
+// while kMaxOrderedMembers members wait to be written.
+class ParallelCompressor : public ChunkCompressor
+{
+public:
+    ParallelCompressor(size_t real_flush, int level);
+    virtual ~ParallelCompressor();
+
+    virtual void Submit(std::string& data, size_t logs, 
+        const log4cplus::helpers::Time& first, 
+        const log4cplus::helpers::Time& last, 
+        const LogFilePtr& file, bool force);
+    virtual void Drain();
+
+private:
+    struct Member : public CompressTask
+    {
+        ParallelCompressor* owner;
+        std::string input;
+        std::string output;
+        size_t logs;
+        log4cplus::helpers::Time first;
+        log4cplus::helpers::Time last;
+        LogFilePtr file;
+        int error;
+        bool done;
+
+        virtual void Run();
+    };
+
+    Member* Cut();
+    void Complete(Member* member);
+
+    boost::mutex mutex_;
+    boost::condition_variable drained_;
+    boost::condition_variable space_;
+    Member* pending_;
+    // Set while a worker writes finished members, see Complete().
+    bool writing_;
+    std::deque<Member*> ordered_;
+    std::vector<Member*> spare_;
+    size_t real_flush_;
+    int level_;
+};
+
+class CompressPool : boost::noncopyable
+{
+public:
+    CompressPool();
+
+    // Grows the pool to at least the given number of workers.
+    void Start(size_t threads);
+    void Schedule(CompressTask* task);
+
+private:
+    void Run();
+
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+    boost::condition_variable space_;
+    std::deque<CompressTask*> ready_;
+    boost::thread_group threads_;
+    size_t size_;
+};
+
+CompressPool& getCompressPool();
+
+} // namespace slog
+
+#endif
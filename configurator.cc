@@ -11,14 +11,21 @@
 #include <log4cplus/asyncappender.h>
 #include <log4cplus/log4judpappender.h>
 #include <log4cplus/helpers/fileinfo.h>
+#include <log4cplus/helpers/stringhelper.h>
 
 #include "file_appender.h"
 #include "pattern_layout.h"
+#include "async_logger.h"
+#include "logger_impl.h"
 
 namespace slog 
 {
 
+const unsigned long kDefaultAsyncQueueSize = 64 << 10;
+const unsigned long kMinimumAsyncQueueSize = 1 << 10;
+
 void initializeLog();
+void invalidateLogSites();
 
 PropertyConfigurator::PropertyConfigurator(const tstring& propertyFile,
     Hierarchy& hier, unsigned f)
@@ -77,6 +84,44 @@ void PropertyConfigurator::configure()
     }
 
     appenders.clear();
+    configureAsync();
+    LoggerImpl::invalidateChains();
+    invalidateLogSites();
+}
+
+void PropertyConfigurator::configureAsync()
+{
+    bool async = false;
+    properties.getBool(async, LOG4CPLUS_TEXT("async"));
+    if (!async)
+    {
+        getAsyncLogger().Stop();
+
+        return;
+    }
+
+    unsigned long queueSize = kDefaultAsyncQueueSize;
+    properties.getULong(queueSize, LOG4CPLUS_TEXT("async.QueueSize"));
+    if (queueSize < kMinimumAsyncQueueSize)
+    {
+        queueSize = kMinimumAsyncQueueSize;
+    }
+
+    AsyncOverflowPolicy policy = kOverflowBlock;
+    tstring overflow = helpers::toLower(
+        properties.getProperty(LOG4CPLUS_TEXT("async.Overflow")));
+    if (overflow == LOG4CPLUS_TEXT("drop"))
+    {
+        policy = kOverflowDrop;
+    }
+    else if (!overflow.empty() && overflow != LOG4CPLUS_TEXT("block"))
+    {
+        helpers::getLogLog().warn(
+            LOG4CPLUS_TEXT("PropertyConfigurator- \"async.Overflow\" not valid: ")
+            + overflow);
+    }
+
+    getAsyncLogger().Start(queueSize, policy);
 }
 
 void PropertyConfigurator::reconfigure() 
@@ -141,6 +186,8 @@ void ConfigurationWatchDogThread::run()
         bool modified = checkForFileModification();
         if (modified) 
         {
+            getAsyncLogger().Stop();
+
             HierarchyLocker theLock(h);
             lock = &theLock;
 
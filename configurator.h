@@ -25,6 +25,7 @@ public:
 protected:
     void init();
     void reconfigure();
+    void configureAsync();
 
 private:
     log4cplus::helpers::Properties origin_properties;
@@ -21,6 +21,7 @@ int main(int argc, char** argv)
     LOG(INFO) << "Hello, I'm INFO.";
     LOG(WARN) << "Hello, I'm WARN.";
     LOG(ERROR) << "Hello, I'm ERROR.";
+    sLogf("Test", INFO, "Hello, I'm %s number %d.", "INFO", 2);
 
     cout << "test finish." << endl;
 
@@ -1,7 +1,14 @@
 #include "file_appender.h"
+#include "binary_layout.h"
+#include "pattern_layout.h"
+#include "compress_pool.h"
+#include "time_util.h"
+#include "block_index.h"
+#include "logger_impl.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <log4cplus/layout.h>
 #include <log4cplus/streams.h>
 #include <log4cplus/helpers/loglog.h>
@@ -13,10 +20,15 @@
 #include <log4cplus/spi/factory.h>
 #include <log4cplus/thread/syncprims-pub-impl.h>
 #include <log4cplus/internal/internal.h>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <fcntl.h>
+#include <signal.h>
 #include <algorithm>
 #include <cstdio>
+#include <deque>
 #include <stdexcept>
+#include <typeinfo>
 #include <stdio.h>
 #include <cerrno>
 
@@ -43,6 +55,7 @@ const size_t kDefaultBufferSize = 4 << 10;
 const size_t kMinimumCompressFlushSize = 4 << 10;
 const size_t kDefaultCompressFlushSize = 512 << 10;
 const float kDefaultDynamicBufferFactor = 1.2;
+const unsigned kStatInterval = 1024;
 
 namespace
 {
@@ -120,6 +133,99 @@ static void rolloverFiles(const tstring& filename,
     }
 }
 
+static tstring sequenceName(const tstring& filename, unsigned long seq, 
+    const tstring& tail) 
+{
+    tostringstream oss;
+    oss << filename << LOG4CPLUS_TEXT(".") << seq << tail;
+
+    return oss.str();
+}
+
+// Splits filename into the directory holding its backups and the prefix
+// their names start with.
+static tstring backupDir(const tstring& filename, tstring& prefix) 
+{
+    tstring::size_type slash = filename.rfind(LOG4CPLUS_TEXT('/'));
+    prefix = filename + LOG4CPLUS_TEXT(".");
+    if (slash == tstring::npos) 
+    {
+        return LOG4CPLUS_TEXT(".");
+    }
+    prefix = prefix.substr(slash + 1);
+
+    return (slash == 0) ? LOG4CPLUS_TEXT("/") : filename.substr(0, slash);
+}
+
+static void listFiles(const tstring& dir, const tstring& prefix, 
+    std::vector<tstring>& names) 
+{
+    DIR* d = opendir(LOG4CPLUS_TSTRING_TO_STRING(dir).c_str());
+    if (!d) 
+    {
+        return;
+    }
+
+    struct dirent* entry = NULL;
+    while ((entry = readdir(d)) != NULL) 
+    {
+        tstring name = entry->d_name;
+        if (name.compare(0, prefix.size(), prefix) == 0) 
+        {
+            names.push_back(name);
+        }
+    }
+    closedir(d);
+}
+
+static bool endsWith(const tstring& str, const tstring& suffix) 
+{
+    return str.size() >= suffix.size() 
+        && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Finds the sequence backups of filename on disk, oldest first. Numbers
+// only grow under sequence naming, but backups left by index naming count
+// down from .1, so the age is taken from the file and not from the number.
+static void scanSequences(const tstring& filename, const tstring& tail, 
+    std::deque<unsigned long>& seqs) 
+{
+    tstring prefix;
+    std::vector<tstring> names;
+    listFiles(backupDir(filename, prefix), prefix, names);
+
+    std::vector<std::pair<Time, unsigned long> > found;
+    for (size_t i = 0; i < names.size(); i++) 
+    {
+        const tstring& name = names[i];
+        if (name.size() <= prefix.size() + tail.size() || !endsWith(name, tail)) 
+        {
+            continue;
+        }
+
+        tstring seq = name.substr(prefix.size(), 
+            name.size() - prefix.size() - tail.size());
+        if (seq.find_first_not_of(LOG4CPLUS_TEXT("0123456789")) != tstring::npos) 
+        {
+            continue;
+        }
+
+        unsigned long n = strtoul(seq.c_str(), NULL, 10);
+        helpers::FileInfo fi;
+        if (getFileInfo(&fi, sequenceName(filename, n, tail)) == 0) 
+        {
+            found.push_back(std::make_pair(fi.mtime, n));
+        }
+    }
+    std::sort(found.begin(), found.end());
+
+    seqs.clear();
+    for (size_t i = 0; i < found.size(); i++) 
+    {
+        seqs.push_back(found[i].second);
+    }
+}
+
 log4cplus::tstring& ltrim(log4cplus::tstring& ss)
 {
     tstring::iterator p = find_if(ss.begin(),
@@ -143,6 +249,264 @@ log4cplus::tstring& trim(log4cplus::tstring& ss)
     return ltrim(rtrim(ss));
 } 
 
+// Shared thread flushing appenders that set FlushInterval. It holds its
+// mutex while flushing, so an appender that has been unregistered is no
+// longer touched. Appenders unregister before taking their access_mutex.
+class BufferFlusher : boost::noncopyable 
+{
+public:
+    BufferFlusher() 
+    {
+    }
+
+    void Register(FileAppender* appender, int interval);
+    void Unregister(FileAppender* appender);
+
+private:
+    struct Entry 
+    {
+        FileAppender* appender;
+        int interval;
+        Time next;
+    };
+
+    void Run();
+
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+    std::vector<Entry> entries_;
+    boost::scoped_ptr<boost::thread> thread_;
+};
+
+void BufferFlusher::Register(FileAppender* appender, int interval) 
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    Entry entry;
+    entry.appender = appender;
+    entry.interval = interval;
+    entry.next = Time::gettimeofday() + Time(interval / 1000, interval % 1000 * 1000);
+    entries_.push_back(entry);
+
+    if (!thread_) 
+    {
+        thread_.reset(new boost::thread(boost::bind(&BufferFlusher::Run, this)));
+    }
+    cond_.notify_one();
+}
+
+void BufferFlusher::Unregister(FileAppender* appender) 
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    std::vector<Entry>::iterator it = entries_.begin();
+    for ( ; it != entries_.end(); ++it) 
+    {
+        if (it->appender == appender) 
+        {
+            entries_.erase(it);
+
+            break;
+        }
+    }
+}
+
+void BufferFlusher::Run() 
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    while (true) 
+    {
+        Time now = Time::gettimeofday();
+        Time wakeup = now + Time(1);
+        std::vector<Entry>::iterator it = entries_.begin();
+        for ( ; it != entries_.end(); ++it) 
+        {
+            if (it->next <= now) 
+            {
+                it->appender->flushBuffers();
+                it->next = now + Time(it->interval / 1000, it->interval % 1000 * 1000);
+            }
+
+            if (it->next < wakeup) 
+            {
+                wakeup = it->next;
+            }
+        }
+
+        Time wait = wakeup - now;
+        cond_.timed_wait(lock, boost::posix_time::milliseconds(
+            wait.sec() * 1000 + wait.usec() / 1000 + 1));
+    }
+}
+
+// Never destroyed, appenders may be closed by static destructors.
+static BufferFlusher& getBufferFlusher() 
+{
+    static BufferFlusher* flusher = new BufferFlusher();
+
+    return *flusher;
+}
+
+// Runs rollover renames and closes retired files off the logging threads.
+// One thread runs the jobs in order, so back to back rollovers of the same
+// file still cascade correctly.
+class BackgroundRotator : boost::noncopyable 
+{
+public:
+    BackgroundRotator() 
+        : busy_(false)
+    {
+    }
+
+    // rolled is where the current file was moved, it ends up as .1.
+    void Rollover(const tstring& filename, const tstring& rolled, 
+        int maxBackupIndex, const tstring& tail);
+    void Retire(const std::vector<LogFilePtr>& files);
+    void Remove(const tstring& filename);
+    // Drops the oldest sequence backups of filename beyond maxBackupIndex,
+    // whichever process wrote them.
+    void Prune(const tstring& filename, int maxBackupIndex, 
+        const tstring& tail);
+    void Drain();
+
+private:
+    struct Job 
+    {
+        tstring filename;
+        tstring rolled;
+        int maxBackupIndex;
+        tstring tail;
+        tstring removed;
+        tstring pruned;
+        std::vector<LogFilePtr> files;
+    };
+
+    void Push(const Job& job);
+    void Run();
+
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+    boost::condition_variable idle_;
+    std::deque<Job> jobs_;
+    bool busy_;
+    boost::scoped_ptr<boost::thread> thread_;
+};
+
+void BackgroundRotator::Rollover(const tstring& filename, const tstring& rolled, 
+    int maxBackupIndex, const tstring& tail) 
+{
+    Job job;
+    job.filename = filename;
+    job.rolled = rolled;
+    job.maxBackupIndex = maxBackupIndex;
+    job.tail = tail;
+    Push(job);
+}
+
+void BackgroundRotator::Retire(const std::vector<LogFilePtr>& files) 
+{
+    Job job;
+    job.maxBackupIndex = 0;
+    job.files = files;
+    Push(job);
+}
+
+void BackgroundRotator::Remove(const tstring& filename) 
+{
+    Job job;
+    job.maxBackupIndex = 0;
+    job.removed = filename;
+    Push(job);
+}
+
+void BackgroundRotator::Prune(const tstring& filename, int maxBackupIndex, 
+    const tstring& tail) 
+{
+    Job job;
+    job.maxBackupIndex = maxBackupIndex;
+    job.tail = tail;
+    job.pruned = filename;
+    Push(job);
+}
+
+void BackgroundRotator::Push(const Job& job) 
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    jobs_.push_back(job);
+    if (!thread_) 
+    {
+        thread_.reset(new boost::thread(boost::bind(&BackgroundRotator::Run, this)));
+    }
+    cond_.notify_one();
+}
+
+void BackgroundRotator::Drain() 
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    while (busy_ || !jobs_.empty()) 
+    {
+        idle_.wait(lock);
+    }
+}
+
+void BackgroundRotator::Run() 
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    while (true) 
+    {
+        if (jobs_.empty()) 
+        {
+            idle_.notify_all();
+            cond_.wait(lock);
+
+            continue;
+        }
+
+        Job job = jobs_.front();
+        jobs_.pop_front();
+        busy_ = true;
+        lock.unlock();
+
+        if (!job.rolled.empty()) 
+        {
+            rolloverFiles(job.filename, job.maxBackupIndex, job.tail);
+            tstring target = job.filename + LOG4CPLUS_TEXT(".1") + job.tail;
+            long ret = file_rename(job.rolled, target);
+            loglog_renaming_result(getLogLog(), job.rolled, target, ret);
+        }
+
+        if (!job.removed.empty()) 
+        {
+            file_remove(job.removed);
+        }
+
+        // Runs after the removes queued before it, so nothing is pruned
+        // twice.
+        if (!job.pruned.empty()) 
+        {
+            std::deque<unsigned long> seqs;
+            scanSequences(job.pruned, job.tail, seqs);
+            while (seqs.size() > (size_t)job.maxBackupIndex) 
+            {
+                tstring oldest = sequenceName(job.pruned, seqs.front(), job.tail);
+                file_remove(oldest);
+                file_remove(oldest + kBlockIndexSuffix);
+                seqs.pop_front();
+            }
+        }
+        job.files.clear();
+
+        lock.lock();
+        busy_ = false;
+    }
+}
+
+// Never destroyed, appenders may be closed by static destructors.
+static BackgroundRotator& getBackgroundRotator() 
+{
+    static BackgroundRotator* rotator = new BackgroundRotator();
+
+    return *rotator;
+}
+
 } // namespace
 
 DynamicBuffer::DynamicBuffer(size_t initial, double factor)
@@ -161,12 +525,100 @@ void DynamicBuffer::Extend()
     buf_ = (char*)realloc(buf_, size_);
 }
 
-bool LogBuffer::ShouldFlush() const 
+ssize_t LogFile::WriteBlock(const char* data, size_t size, 
+    const Time& first, const Time& last)
+{
+    if (index_fd_ < 0) 
+    {
+        return Write(data, size);
+    }
+
+    // Buffers flush into the same file from several threads, a block only
+    // knows where it landed while no other block is being written. The
+    // offset comes from the descriptor, other processes appending to the
+    // file make the tracked size wrong.
+    boost::mutex::scoped_lock lock(block_mutex_);
+    ssize_t ret = Write(data, size);
+    if (ret < 0) 
+    {
+        return ret;
+    }
+
+    off_t end = lseek(fd_, 0, SEEK_CUR);
+    if (end < ret) 
+    {
+        std::stringstream errmsg;
+        errmsg << "Locate block: " << strerror(errno);
+        getLogLog().error(errmsg.str());
+
+        return ret;
+    }
+
+    BlockIndexEntry entry;
+    entry.offset = end - ret;
+    entry.length = ret;
+    entry.first = first.sec() * 1000000LL + first.usec();
+    entry.last = last.sec() * 1000000LL + last.usec();
+    if (write(index_fd_, &entry, sizeof(entry)) != sizeof(entry)) 
+    {
+        std::stringstream errmsg;
+        errmsg << "Write block index: " << strerror(errno);
+        getLogLog().error(errmsg.str());
+    }
+
+    return ret;
+}
+
+ssize_t LogFile::Write(const char* data, size_t size)
+{
+    size_t done = 0;
+    while (done < size) 
+    {
+        ssize_t n = write(fd_, data + done, size - done);
+        if (n < 0) 
+        {
+            if (errno == EINTR) 
+            {
+                continue;
+            }
+
+            return -1;
+        }
+        done += n;
+    }
+    __atomic_add_fetch(&size_, done, __ATOMIC_RELAXED);
+
+    return done;
+}
+
+bool LogFile::Stat()
+{
+    boost::mutex::scoped_lock lock(block_mutex_);
+    struct stat st = {};
+    if (fstat(fd_, &st) < 0) 
+    {
+        return false;
+    }
+    __atomic_store_n(&size_, st.st_size, __ATOMIC_RELAXED);
+
+    return true;
+}
+
+AppendStreamBuf::int_type AppendStreamBuf::overflow(int_type c)
+{
+    if (!traits_type::eq_int_type(c, traits_type::eof())) 
+    {
+        output_.push_back(traits_type::to_char_type(c));
+    }
+
+    return traits_type::not_eof(c);
+}
+
+std::streamsize AppendStreamBuf::xsputn(const char* s, std::streamsize n)
 {
-    size_t used = stream_.rdbuf()->pubseekoff(0, std::ios_base::cur, 
-        std::ios_base::out);
+    output_.append(s, n);
 
-    return used >= max_;
+    return n;
 }
 
 int LogBuffer::Flush(bool) 
@@ -176,10 +628,7 @@ int LogBuffer::Flush(bool)
         return -1;
     }
 
-    std::string buf = stream_.str();
-    size_t used = stream_.rdbuf()->pubseekoff(0, std::ios_base::cur, 
-        std::ios_base::out);
-    int ret = write(file_->fd(), buf.data(), used);
+    int ret = file_->Write(data_.data(), data_.size());
     Clear();
 
     return ret;
@@ -187,15 +636,17 @@ int LogBuffer::Flush(bool)
 
 void LogBuffer::Clear() 
 {
-    stream_.rdbuf()->pubseekpos(0, std::ios_base::out);
+    data_.clear();
     logs_ = 0; 
+    first_ = Time();
+    last_ = Time();
     if (file_) 
     {
         file_.reset();
     }
 }
 
-GzLogBuffer::GzLogBuffer(size_t max, size_t real_flush)
+GzLogBuffer::GzLogBuffer(size_t max, size_t real_flush, int level)
     : LogBuffer(max)
     , real_flush_(real_flush)
     , input_size_(0)
@@ -203,7 +654,7 @@ GzLogBuffer::GzLogBuffer(size_t max, size_t real_flush)
     , offset_(0)
 {
     memset(&strm_, 0, sizeof(strm_));
-    int ret = ::deflateInit2(&strm_, Z_DEFAULT_COMPRESSION, 
+    int ret = ::deflateInit2(&strm_, level, 
         Z_DEFLATED, 15|16, 8, Z_DEFAULT_STRATEGY);
     (void)ret;
 }
@@ -220,10 +671,8 @@ int GzLogBuffer::Flush(bool force)
         return -1;
     }
 
-    std::string buf = stream_.str();
-    const char* input = buf.data();
-    int inlen = stream_.rdbuf()->pubseekoff(0, std::ios_base::cur, 
-        std::ios_base::out);
+    const char* input = data_.data();
+    int inlen = data_.size();
     input_size_ += inlen;
 
     strm_.next_in = (Bytef*)input;
@@ -248,7 +697,7 @@ int GzLogBuffer::Flush(bool force)
                 offset_ += out_avail - strm_.avail_out;
                 if (strm_.avail_in == 0) 
                 {
-                    stream_.rdbuf()->pubseekpos(0, std::ios_base::out);
+                    data_.clear();
 
                     break;
                 }
@@ -302,27 +751,248 @@ int GzLogBuffer::Flush(bool force)
 
         if (ret >= 0) 
         {
-            ret = write(file_->fd(), buffer_.ptr(), offset_);
+            ret = file_->WriteBlock(buffer_.ptr(), offset_, first_, last_);
+            Clear();
+        }
+    }
+
+    return ret;
+}
+
+void GzLogBuffer::Clear() 
+{
+    LogBuffer::Clear();
+    input_size_ = 0;
+    offset_ = 0;
+    ::deflateReset(&strm_);
+}
+
+AsyncGzLogBuffer::AsyncGzLogBuffer(size_t max, size_t real_flush, 
+    int level, bool parallel)
+    : LogBuffer(max)
+{
+    if (parallel) 
+    {
+        compressor_.reset(new ParallelCompressor(real_flush, level));
+    } 
+    else 
+    {
+        compressor_.reset(new CompressStrand(max, real_flush, level));
+    }
+}
+
+AsyncGzLogBuffer::~AsyncGzLogBuffer() 
+{
+}
+
+int AsyncGzLogBuffer::Flush(bool force) 
+{
+    if (!file_) 
+    {
+        return -1;
+    }
+
+    int ret = data_.size();
+    compressor_->Submit(data_, logs_, first_, last_, file_, force);
+    Clear();
+
+    return ret;
+}
+
+void AsyncGzLogBuffer::Drain() 
+{
+    compressor_->Drain();
+}
+
+#ifdef SLOG_HAVE_ZSTD
+ZstdLogBuffer::ZstdLogBuffer(size_t max, size_t real_flush, 
+    int level, int window_log)
+    : LogBuffer(max)
+    , real_flush_(real_flush)
+    , input_size_(0)
+    , buffer_(max, 1.5)
+    , offset_(0)
+    , error_(NULL)
+{
+    cctx_ = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, level);
+    if (window_log > 0) 
+    {
+        ZSTD_CCtx_setParameter(cctx_, ZSTD_c_enableLongDistanceMatching, 1);
+        ZSTD_CCtx_setParameter(cctx_, ZSTD_c_windowLog, window_log);
+    }
+}
+
+ZstdLogBuffer::~ZstdLogBuffer() 
+{
+    ZSTD_freeCCtx(cctx_);
+}
+
+int ZstdLogBuffer::Flush(bool force) 
+{
+    if (!file_) 
+    {
+        return -1;
+    }
+
+    input_size_ += data_.size();
+    ZSTD_inBuffer in = { data_.data(), data_.size(), 0 };
+    ZSTD_EndDirective mode = (input_size_ < real_flush_ && !force) 
+        ? ZSTD_e_continue : ZSTD_e_end;
+
+    size_t left = 0;
+    do 
+    {
+        buffer_.Reserve(offset_ + 128);
+        ZSTD_outBuffer out = { buffer_.ptr(), buffer_.size(), offset_ };
+        left = ZSTD_compressStream2(cctx_, &out, &in, mode);
+        offset_ = out.pos;
+        if (ZSTD_isError(left)) 
+        {
+            error_ = ZSTD_getErrorName(left);
+            Clear();
+
+            return -2;
+        }
+    } while (mode == ZSTD_e_end ? left != 0 : in.pos < in.size);
+
+    if (mode == ZSTD_e_continue) 
+    {
+        data_.clear();
+
+        return 0;
+    }
+
+    int ret = file_->WriteBlock(buffer_.ptr(), offset_, first_, last_);
+    Clear();
+
+    return ret;
+}
+
+const char* ZstdLogBuffer::CompressError(int) const 
+{
+    return error_ ? error_ : "unknown zstd error";
+}
+
+void ZstdLogBuffer::Clear() 
+{
+    LogBuffer::Clear();
+    input_size_ = 0;
+    offset_ = 0;
+    ZSTD_CCtx_reset(cctx_, ZSTD_reset_session_only);
+}
+#endif
+
+#ifdef SLOG_HAVE_LZ4
+Lz4LogBuffer::Lz4LogBuffer(size_t max, size_t real_flush, int level)
+    : LogBuffer(max)
+    , real_flush_(real_flush)
+    , input_size_(0)
+    , buffer_(max, 1.5)
+    , offset_(0)
+    , cctx_(NULL)
+    , started_(false)
+    , error_(NULL)
+{
+    memset(&prefs_, 0, sizeof(prefs_));
+    prefs_.compressionLevel = level;
+    LZ4F_errorCode_t ret = LZ4F_createCompressionContext(&cctx_, LZ4F_VERSION);
+    (void)ret;
+}
+
+Lz4LogBuffer::~Lz4LogBuffer() 
+{
+    LZ4F_freeCompressionContext(cctx_);
+}
+
+int Lz4LogBuffer::Flush(bool force) 
+{
+    if (!file_) 
+    {
+        return -1;
+    }
+
+    size_t n = 0;
+    if (!started_) 
+    {
+        buffer_.Reserve(offset_ + LZ4F_HEADER_SIZE_MAX);
+        n = LZ4F_compressBegin(cctx_, buffer_.ptr() + offset_, 
+            buffer_.size() - offset_, &prefs_);
+        if (LZ4F_isError(n)) 
+        {
+            error_ = LZ4F_getErrorName(n);
             Clear();
+
+            return -2;
         }
+        offset_ += n;
+        started_ = true;
+    }
+
+    input_size_ += data_.size();
+    buffer_.Reserve(offset_ + LZ4F_compressBound(data_.size(), &prefs_));
+    n = LZ4F_compressUpdate(cctx_, buffer_.ptr() + offset_, 
+        buffer_.size() - offset_, data_.data(), data_.size(), NULL);
+    if (LZ4F_isError(n)) 
+    {
+        error_ = LZ4F_getErrorName(n);
+        Clear();
+
+        return -2;
+    }
+    offset_ += n;
+
+    if ((input_size_ < real_flush_) && !force) 
+    {
+        data_.clear();
+
+        return 0;
+    }
+
+    buffer_.Reserve(offset_ + LZ4F_compressBound(0, &prefs_));
+    n = LZ4F_compressEnd(cctx_, buffer_.ptr() + offset_, 
+        buffer_.size() - offset_, NULL);
+    if (LZ4F_isError(n)) 
+    {
+        error_ = LZ4F_getErrorName(n);
+        Clear();
+
+        return -2;
     }
+    offset_ += n;
+
+    int ret = file_->WriteBlock(buffer_.ptr(), offset_, first_, last_);
+    Clear();
 
     return ret;
 }
 
-void GzLogBuffer::Clear() 
+const char* Lz4LogBuffer::CompressError(int) const 
+{
+    return error_ ? error_ : "unknown lz4 error";
+}
+
+// LZ4F_compressBegin() restarts the context, nothing to reset here.
+void Lz4LogBuffer::Clear() 
 {
     LogBuffer::Clear();
     input_size_ = 0;
     offset_ = 0;
-    ::deflateReset(&strm_);
+    started_ = false;
 }
+#endif
 
 FileAppender::FileAppender(const tstring& filename_, bool immediateFlush_)
     : immediateFlush(immediateFlush_)
+    , flushInterval(0)
     , reopenDelay(1)
     , bufferSize(kDefaultBufferSize)
     , compressFlushSize(kDefaultCompressFlushSize)
+    , compressLevel(0)
+    , compressWindowLog(0)
+    , compressThreads(0)
+    , compressParallel(false)
+    , compressIndex(false)
     , appendMode(true)
     , compressType(kNoCompress)
     , closeOnExec(false)
@@ -333,9 +1003,15 @@ FileAppender::FileAppender(const tstring& filename_, bool immediateFlush_)
 FileAppender::FileAppender(const Properties& props)
     : Appender(props)
     , immediateFlush(false)
+    , flushInterval(0)
     , reopenDelay(1)
     , bufferSize(kDefaultBufferSize)
     , compressFlushSize(kDefaultCompressFlushSize)
+    , compressLevel(0)
+    , compressWindowLog(0)
+    , compressThreads(0)
+    , compressParallel(false)
+    , compressIndex(false)
     , appendMode(true)
     , compressType(kNoCompress)
     , closeOnExec(false)
@@ -353,6 +1029,7 @@ FileAppender::FileAppender(const Properties& props)
     props.getBool(immediateFlush, LOG4CPLUS_TEXT("ImmediateFlush"));
     props.getBool(append, LOG4CPLUS_TEXT("Append"));
     props.getInt(reopenDelay, LOG4CPLUS_TEXT("ReopenDelay"));
+    props.getInt(flushInterval, LOG4CPLUS_TEXT("FlushInterval"));
     props.getULong(bufferSize, LOG4CPLUS_TEXT("BufferSize"));
     if (bufferSize < kMinimumBufferSize) 
     {
@@ -374,6 +1051,24 @@ FileAppender::FileAppender(const Properties& props)
         compressType = kGzCompress;
         fileNamePostfix = LOG4CPLUS_TEXT(".gz");
     }
+    else if (compress == LOG4CPLUS_TEXT("zstd")) 
+    {
+#ifdef SLOG_HAVE_ZSTD
+        compressType = kZstdCompress;
+        fileNamePostfix = LOG4CPLUS_TEXT(".zst");
+#else
+        getLogLog().error(LOG4CPLUS_TEXT("Compress=zstd needs slog built with WITH_ZSTD=1"));
+#endif
+    }
+    else if (compress == LOG4CPLUS_TEXT("lz4")) 
+    {
+#ifdef SLOG_HAVE_LZ4
+        compressType = kLz4Compress;
+        fileNamePostfix = LOG4CPLUS_TEXT(".lz4");
+#else
+        getLogLog().error(LOG4CPLUS_TEXT("Compress=lz4 needs slog built with WITH_LZ4=1"));
+#endif
+    }
 
     if (compressType != kNoCompress) 
     {
@@ -384,9 +1079,35 @@ FileAppender::FileAppender(const Properties& props)
             compressFlushSize = minimum;
         }
         immediateFlush = false;
+
+        props.getInt(compressLevel, LOG4CPLUS_TEXT("CompressLevel"));
+        if (compressType == kGzCompress 
+            && (compressLevel < 0 || compressLevel > Z_BEST_COMPRESSION)) 
+        {
+            getLogLog().error(LOG4CPLUS_TEXT("CompressLevel for gz must be 0 (default) to 9"));
+            compressLevel = 0;
+        }
+        props.getInt(compressWindowLog, LOG4CPLUS_TEXT("CompressWindowLog"));
+        props.getInt(compressThreads, LOG4CPLUS_TEXT("CompressThreads"));
+        props.getBool(compressParallel, LOG4CPLUS_TEXT("CompressParallel"));
+        props.getBool(compressIndex, LOG4CPLUS_TEXT("CompressIndex"));
+        if (compressThreads > 0 && compressType == kGzCompress) 
+        {
+            getCompressPool().Start(compressThreads);
+        }
+        else if (compressParallel) 
+        {
+            getLogLog().error(LOG4CPLUS_TEXT("CompressParallel needs Compress=gz")
+                LOG4CPLUS_TEXT(" and CompressThreads > 0, ignored"));
+        }
     }
 
     init(fn, lockFileName);
+
+    if (flushInterval > 0 && !immediateFlush) 
+    {
+        getBufferFlusher().Register(this, flushInterval);
+    }
 }
 
 void FileAppender::init(const tstring& filenames, 
@@ -421,48 +1142,96 @@ FileAppender::~FileAppender()
 
 void FileAppender::close()
 {
-    thread::MutexGuard guard(access_mutex);
-    size_t total_logs = 0;
-    std::list<boost::shared_ptr<LogBuffer> >::iterator it = buffers.begin();
-    for ( ; it != buffers.end(); ) 
+    if (flushInterval > 0) 
     {
-        size_t logs = (*it)->GetLogCount();
-        if (logs != 0) 
-        {
-            total_logs += logs;
-            ++it;
-        } 
-        else 
-        {
-            buffers.erase(it++);
-        }
+        getBufferFlusher().Unregister(this);
     }
 
-    if (total_logs) 
+    std::list<boost::shared_ptr<LogBuffer> > all;
     {
-        for (it = buffers.begin(); it != buffers.end(); ++it) 
+        thread::MutexGuard guard(access_mutex);
+        all = buffers;
+        size_t total_logs = 0;
+        std::list<boost::shared_ptr<LogBuffer> >::iterator it = buffers.begin();
+        for ( ; it != buffers.end(); ) 
         {
-            if (!(*it)->file()) 
+            size_t logs = (*it)->GetLogCount();
+            if (logs != 0) 
             {
-                if (!openFile((*it)->index())) 
-                {
-                    std::stringstream errmsg;
-                    errmsg << "Dropped " << (*it)->GetLogCount() << " logs. "
-                        << "Open " << currentFileNames[(*it)->index()] << ": "
-                        << strerror(errno);
-                    getLogLog().error(errmsg.str());
+                total_logs += logs;
+                ++it;
+            } 
+            else 
+            {
+                buffers.erase(it++);
+            }
+        }
 
-                    continue;
+        if (total_logs) 
+        {
+            for (it = buffers.begin(); it != buffers.end(); ++it) 
+            {
+                if (!(*it)->file()) 
+                {
+                    if (!openFile((*it)->index())) 
+                    {
+                        std::stringstream errmsg;
+                        errmsg << "Dropped " << (*it)->GetLogCount() << " logs. "
+                            << "Open " << currentFileNames[(*it)->index()] << ": "
+                            << strerror(errno);
+                        getLogLog().error(errmsg.str());
+
+                        continue;
+                    }
                 }
-            }
 
-            const boost::shared_ptr<LogBuffer>& buffer = (*it);
-            FlushBuffer(buffer, true, false);
+                const boost::shared_ptr<LogBuffer>& buffer = (*it);
+                FlushBuffer(buffer, true, false);
+            }
         }
+
+        closeFiles();
+        closed = true;
+    }
+
+    // Compression workers and the rotator hold their own references to
+    // the files. Waiting for them does not need the appender locked.
+    std::list<boost::shared_ptr<LogBuffer> >::iterator it = all.begin();
+    for (; it != all.end(); ++it) 
+    {
+        (*it)->Drain();
+    }
+    getBackgroundRotator().Drain();
+}
+
+void FileAppender::setThreshold(LogLevel th)
+{
+    Appender::setThreshold(th);
+    LoggerImpl::invalidateChains();
+}
+
+void FileAppender::setFilter(spi::FilterPtr f)
+{
+    Appender::setFilter(f);
+    LoggerImpl::invalidateChains();
+}
+
+void FileAppender::flushBuffers()
+{
+    thread::MutexGuard guard(access_mutex);
+    if (closed) 
+    {
+        return;
     }
 
-    closeFiles();
-    closed = true;
+    std::list<boost::shared_ptr<LogBuffer> >::iterator it = buffers.begin();
+    for ( ; it != buffers.end(); ++it) 
+    {
+        if ((*it)->GetLogCount() != 0 && (*it)->file()) 
+        {
+            FlushBuffer(*it, true, false);
+        }
+    }
 }
 
 void FileAppender::closeFiles() 
@@ -495,6 +1264,29 @@ int FileAppender::doOpenFile(const std::string& fname,
     return fd;
 }
 
+LogFilePtr FileAppender::newLogFile(int fd, const std::string& fname, 
+    bool append) const
+{
+    LogFilePtr logfile(new LogFile(fd));
+    logfile->Stat();
+    if (compressIndex) 
+    {
+        int index_fd = doOpenFile(fname + kBlockIndexSuffix, append, closeOnExec);
+        if (index_fd < 0) 
+        {
+            std::stringstream errmsg;
+            errmsg << "Open " << fname << kBlockIndexSuffix << ": " << strerror(errno);
+            getLogLog().error(errmsg.str());
+        } 
+        else 
+        {
+            logfile->SetIndex(index_fd);
+        }
+    }
+
+    return logfile;
+}
+
 bool FileAppender::openFiles() 
 {
     currentFileNames = getFileNames();
@@ -511,7 +1303,7 @@ bool FileAppender::openFiles()
         } 
         else 
         {
-            LogFilePtr logfile(new LogFile(fd));
+            LogFilePtr logfile(newLogFile(fd, currentFileNames[i], appendMode));
             if (logFiles.size() > i) 
             {
                 logFiles[i] = logfile;
@@ -523,6 +1315,8 @@ bool FileAppender::openFiles()
         }
     }
 
+    resetLayout();
+
     return true;
 }
 
@@ -538,12 +1332,80 @@ bool FileAppender::openFile(size_t index)
     } 
     else 
     {
-        logFiles[index].reset(new LogFile(fd));
+        logFiles[index] = newLogFile(fd, currentFileNames[index], appendMode);
+        resetLayout();
 
         return true;
     }
 }
 
+bool FileAppender::reopenFailedFiles() 
+{
+    for (size_t i = 0; i < logFiles.size(); i++) 
+    {
+        if (!logFiles[i] || !logFiles[i]->failed()) 
+        {
+            continue;
+        }
+
+        closeFile(i);
+        if (!openFile(i)) 
+        {
+            std::stringstream errmsg;
+            errmsg << "Dropped logs. Open "
+                << currentFileNames[i] << ": " << strerror(errno);
+            getLogLog().error(errmsg.str());
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void FileAppender::resetLayout()
+{
+    BinaryLayout* binary = dynamic_cast<BinaryLayout*>(layout.get());
+    if (binary)
+    {
+        binary->reset();
+    }
+}
+
+LogBuffer* FileAppender::newBuffer() const
+{
+    switch (compressType) 
+    {
+#ifdef SLOG_HAVE_ZSTD
+    case kZstdCompress:
+        return new ZstdLogBuffer(bufferSize, compressFlushSize, 
+            compressLevel, compressWindowLog);
+#endif
+
+#ifdef SLOG_HAVE_LZ4
+    case kLz4Compress:
+        return new Lz4LogBuffer(bufferSize, compressFlushSize, compressLevel);
+#endif
+
+    case kGzCompress:
+    {
+        // 0 means the library default everywhere, for zlib it would mean
+        // storing the logs uncompressed.
+        int level = compressLevel ? compressLevel : Z_DEFAULT_COMPRESSION;
+        if (compressThreads > 0) 
+        {
+            return new AsyncGzLogBuffer(bufferSize, compressFlushSize, 
+                level, compressParallel);
+        }
+
+        return new GzLogBuffer(bufferSize, compressFlushSize, level);
+    }
+
+    default:
+        return new LogBuffer(bufferSize);
+    }
+}
+
 void FileAppender::closeFile(size_t index) 
 {
     if (logFiles[index]) 
@@ -576,7 +1438,7 @@ bool FileAppender::FlushBuffer(const boost::shared_ptr<LogBuffer>& buffer,
         } 
         else 
         {
-            errmsg << "Compression: " << zError(r);
+            errmsg << "Compression: " << buffer->CompressError(r);
         }
 
         getLogLog().error(errmsg.str());
@@ -618,19 +1480,16 @@ void FileAppender::append(const spi::InternalLoggingEvent& event)
         }
     }
 
+    if (!reopenFailedFiles()) 
+    {
+        return;
+    }
+
     size_t index = 0;
 
     if (buffers.empty()) 
     {
-        boost::shared_ptr<LogBuffer> buffer;
-        if (compressType == kNoCompress) 
-        {
-            buffer.reset(new LogBuffer(bufferSize));
-        } 
-        else 
-        {
-            buffer.reset(new GzLogBuffer(bufferSize, compressFlushSize));
-        }
+        boost::shared_ptr<LogBuffer> buffer(newBuffer());
 
         index = (index + 1) % fileNames.size();
         if (index >= fileNames.size()) 
@@ -668,8 +1527,21 @@ void FileAppender::append(const spi::InternalLoggingEvent& event)
 
     assert((buffer->file() && buffer->file()->fd() == logFiles[buffer->index()]->fd()) 
         || buffer->GetLogCount() == 0);
-    layout->formatAndAppend(buffer->stream(), event);
-    buffer->AddLogCount();
+    if (typeid(*layout) == typeid(PatternLayout)) 
+    {
+        static_cast<PatternLayout*>(layout.get())->formatAndAppend(
+            buffer->data(), event);
+    } 
+    else if (typeid(*layout) == typeid(BinaryLayout)) 
+    {
+        static_cast<BinaryLayout*>(layout.get())->formatAndAppend(
+            buffer->data(), event);
+    } 
+    else 
+    {
+        layout->formatAndAppend(buffer->stream(), event);
+    }
+    buffer->AddLog(event.getTimestamp());
 
     if (buffer->ShouldFlush() || immediateFlush) 
     {
@@ -682,7 +1554,7 @@ void FileAppender::append(const spi::InternalLoggingEvent& event)
 
         FlushBuffer(buffer, false, true);
 
-        if (compressType == kGzCompress && buffer->file() 
+        if (compressType != kNoCompress && buffer->file() 
             && buffer->file()->fd() != logFiles[buffer->index()]->fd()) 
         {
             FlushBuffer(buffer, true, true);
@@ -699,10 +1571,11 @@ void FileAppender::append(const spi::InternalLoggingEvent& event)
 }
 
 RollingFileAppender::RollingFileAppender(const tstring& filename_,
-    long maxFileSize_, int maxBackupIndex_, bool immediateFlush_)
+    long maxFileSize_, int maxBackupIndex_, bool immediateFlush_,
+    BackupNaming naming)
     : FileAppender(filename_, immediateFlush_)
 {
-    init(maxFileSize_, maxBackupIndex_);
+    init(maxFileSize_, maxBackupIndex_, naming);
 }
 
 RollingFileAppender::RollingFileAppender(const Properties& properties)
@@ -731,10 +1604,18 @@ RollingFileAppender::RollingFileAppender(const Properties& properties)
 
     properties.getInt(tmpMaxBackupIndex, LOG4CPLUS_TEXT("MaxBackupIndex"));
 
-    init(tmpMaxFileSize, tmpMaxBackupIndex);
+    BackupNaming naming = kIndexNaming;
+    tstring tmpNaming = toLower(properties.getProperty(LOG4CPLUS_TEXT("BackupNaming")));
+    if (tmpNaming == LOG4CPLUS_TEXT("sequence")) 
+    {
+        naming = kSequenceNaming;
+    }
+
+    init(tmpMaxFileSize, tmpMaxBackupIndex, naming);
 }
 
-void RollingFileAppender::init(long maxFileSize_, int maxBackupIndex_)
+void RollingFileAppender::init(long maxFileSize_, int maxBackupIndex_, 
+    BackupNaming naming)
 {
     if (maxFileSize_ < MINIMUM_ROLLING_LOG_SIZE) 
     {
@@ -748,6 +1629,19 @@ void RollingFileAppender::init(long maxFileSize_, int maxBackupIndex_)
 
     maxFileSize = maxFileSize_;
     maxBackupIndex = (std::max)(maxBackupIndex_, 1);
+    statCount = 0;
+    rolloverCount = 0;
+    sequenceNaming = (naming == kSequenceNaming);
+    backups.assign(fileNames.size(), std::deque<unsigned long>());
+    if (sequenceNaming) 
+    {
+        for (size_t i = 0; i < fileNames.size(); i++) 
+        {
+            scanBackups(i);
+        }
+    }
+
+    recoverRollovers();
 }
 
 RollingFileAppender::~RollingFileAppender()
@@ -755,6 +1649,171 @@ RollingFileAppender::~RollingFileAppender()
     destructorImpl();
 }
 
+void RollingFileAppender::startRollover(const tstring& filename, 
+    const tstring& rolled, const tstring& tail)
+{
+    long ret = file_rename(filename + tail, rolled + tail);
+    loglog_renaming_result(getLogLog(), filename + tail, rolled + tail, ret);
+    if (ret == 0) 
+    {
+        getBackgroundRotator().Rollover(filename, rolled + tail, 
+            maxBackupIndex, tail);
+    }
+}
+
+void RollingFileAppender::scanBackups(size_t index)
+{
+    scanSequences(fileNames[index], fileNamePostfix, backups[index]);
+}
+
+// Numbers are taken above the newest backup, the stat only matters when
+// another process sharing the file took the same number first.
+unsigned long RollingFileAppender::nextSequence(size_t index) const
+{
+    const std::deque<unsigned long>& seqs = backups[index];
+    unsigned long seq = seqs.empty() ? 1 : seqs.back() + 1;
+    helpers::FileInfo fi;
+    while (getFileInfo(&fi, sequenceName(fileNames[index], seq, fileNamePostfix)) == 0) 
+    {
+        seq++;
+    }
+
+    return seq;
+}
+
+// A process that died between moving its file aside and the background
+// rename leaves <file>.rolling.<pid>.<n> behind. Those of dead processes
+// get their backup name now, oldest first.
+void RollingFileAppender::recoverRollovers()
+{
+    for (size_t i = 0; i < fileNames.size(); i++) 
+    {
+        tstring prefix;
+        tstring dir = backupDir(fileNames[i], prefix);
+        prefix += LOG4CPLUS_TEXT("rolling.");
+        std::vector<tstring> names;
+        listFiles(dir, prefix, names);
+
+        std::vector<std::pair<Time, tstring> > leftovers;
+        for (size_t j = 0; j < names.size(); j++) 
+        {
+            // <pid>.<n> followed by the postfix, index sidecars follow
+            // their file.
+            const tstring& name = names[j];
+            if (name.size() <= prefix.size() + fileNamePostfix.size()
+                || !endsWith(name, fileNamePostfix)) 
+            {
+                continue;
+            }
+
+            tstring id = name.substr(prefix.size(), 
+                name.size() - prefix.size() - fileNamePostfix.size());
+            if (id.find_first_not_of(LOG4CPLUS_TEXT("0123456789.")) != tstring::npos) 
+            {
+                continue;
+            }
+
+            pid_t pid = strtoul(id.c_str(), NULL, 10);
+            if (pid <= 0 || pid == getpid() 
+                || kill(pid, 0) == 0 || errno == EPERM) 
+            {
+                continue;
+            }
+
+            tstring rolled = fileNames[i] + LOG4CPLUS_TEXT(".rolling.") + id;
+            helpers::FileInfo fi;
+            if (getFileInfo(&fi, rolled + fileNamePostfix) == 0) 
+            {
+                leftovers.push_back(std::make_pair(fi.mtime, rolled));
+            }
+        }
+        std::sort(leftovers.begin(), leftovers.end());
+
+        for (size_t j = 0; j < leftovers.size(); j++) 
+        {
+            const tstring& rolled = leftovers[j].second;
+            tstring index = rolled + fileNamePostfix + kBlockIndexSuffix;
+            helpers::FileInfo fi;
+            bool hasIndex = getFileInfo(&fi, index) == 0;
+            if (!sequenceNaming) 
+            {
+                getBackgroundRotator().Rollover(fileNames[i], 
+                    rolled + fileNamePostfix, maxBackupIndex, fileNamePostfix);
+                if (hasIndex) 
+                {
+                    getBackgroundRotator().Rollover(fileNames[i], index, 
+                        maxBackupIndex, fileNamePostfix + kBlockIndexSuffix);
+                }
+
+                continue;
+            }
+
+            unsigned long seq = nextSequence(i);
+            tstring target = sequenceName(fileNames[i], seq, fileNamePostfix);
+            long ret = file_rename(rolled + fileNamePostfix, target);
+            loglog_renaming_result(getLogLog(), rolled + fileNamePostfix, target, ret);
+            if (ret != 0) 
+            {
+                continue;
+            }
+
+            if (hasIndex) 
+            {
+                ret = file_rename(index, target + kBlockIndexSuffix);
+                loglog_renaming_result(getLogLog(), index, 
+                    target + kBlockIndexSuffix, ret);
+            }
+            backups[i].push_back(seq);
+        }
+
+        // Recovered files may be older than the backups, take their place
+        // in the order from the disk.
+        if (sequenceNaming && !leftovers.empty()) 
+        {
+            scanBackups(i);
+        }
+    }
+}
+
+// Gives the current file the next sequence number and prunes the oldest
+// backups, one rename and usually one remove per rollover. The numbers in
+// backups are only scanned from disk at startup, backups of other
+// processes sharing the file are pruned by the background rotator.
+void RollingFileAppender::rolloverToSequence(size_t index)
+{
+    std::deque<unsigned long>& seqs = backups[index];
+    unsigned long seq = nextSequence(index);
+    tstring target = sequenceName(fileNames[index], seq, fileNamePostfix);
+    long ret = file_rename(currentFileNames[index], target);
+    loglog_renaming_result(getLogLog(), currentFileNames[index], target, ret);
+    if (ret != 0) 
+    {
+        return;
+    }
+
+    if (compressIndex) 
+    {
+        ret = file_rename(currentFileNames[index] + kBlockIndexSuffix, 
+            target + kBlockIndexSuffix);
+        loglog_renaming_result(getLogLog(), 
+            currentFileNames[index] + kBlockIndexSuffix, 
+            target + kBlockIndexSuffix, ret);
+    }
+
+    seqs.push_back(seq);
+    while (seqs.size() > (size_t)maxBackupIndex) 
+    {
+        tstring oldest = sequenceName(fileNames[index], seqs.front(), fileNamePostfix);
+        getBackgroundRotator().Remove(oldest);
+        if (compressIndex) 
+        {
+            getBackgroundRotator().Remove(oldest + kBlockIndexSuffix);
+        }
+        seqs.pop_front();
+    }
+    getBackgroundRotator().Prune(fileNames[index], maxBackupIndex, fileNamePostfix);
+}
+
 bool RollingFileAppender::checkAndRollover(size_t index) 
 {
     if (!logFiles[index]) 
@@ -770,19 +1829,23 @@ bool RollingFileAppender::checkAndRollover(size_t index)
     	}
     }
 
-    struct stat st = {};
-    int r = fstat(logFiles[index]->fd(), &st);
-    if (r < 0) 
+    // The tracked size misses other writers to the file, so it is checked
+    // against the file before a rollover and every kStatInterval logs.
+    if (++statCount >= kStatInterval || logFiles[index]->size() >= maxFileSize) 
     {
-        std::stringstream errmsg;
-        errmsg << "stat " << currentFileNames[index] << ": " << strerror(errno);
-        getLogLog().error(errmsg.str());
-        closeFile(index);
+        statCount = 0;
+        if (!logFiles[index]->Stat()) 
+        {
+            std::stringstream errmsg;
+            errmsg << "stat " << currentFileNames[index] << ": " << strerror(errno);
+            getLogLog().error(errmsg.str());
+            closeFile(index);
 
-        return false;
+            return false;
+        }
     }
 
-    if (st.st_size >= maxFileSize) 
+    if (logFiles[index]->size() >= maxFileSize) 
     {
         helpers::FileInfo fi;
         if (getFileInfo(&fi, currentFileNames[index]) == -1
@@ -791,22 +1854,45 @@ bool RollingFileAppender::checkAndRollover(size_t index)
             int fd = doOpenFile(currentFileNames[index], true, closeOnExec);
             if (fd >= 0) 
             {
-                logFiles[index].reset(new LogFile(fd));
+                logFiles[index] = newLogFile(fd, currentFileNames[index], true);
+                resetLayout();
             }
 
             return true;
         }
 
+        if (sequenceNaming) 
+        {
+            rolloverToSequence(index);
+        }
+        else if (maxBackupIndex > 0) 
+        {
+            // Only the current file is moved aside here, the background
+            // rotator shifts the backups and gives it its final name.
+            tostringstream oss;
+            oss << fileNames[index] << LOG4CPLUS_TEXT(".rolling.") 
+                << getpid() << LOG4CPLUS_TEXT(".") << ++rolloverCount;
+            tstring rolled = oss.str();
+
+            startRollover(fileNames[index], rolled, fileNamePostfix);
+            if (compressIndex) 
+            {
+                startRollover(fileNames[index], rolled, 
+                    fileNamePostfix + kBlockIndexSuffix);
+            }
+        }
+
         if (maxBackupIndex > 0) 
         {
-            rolloverFiles(fileNames[index], maxBackupIndex, fileNamePostfix);
-            tstring target = fileNames[index] + LOG4CPLUS_TEXT(".1") + fileNamePostfix;
-
-            getLogLog().debug(LOG4CPLUS_TEXT("Renaming file ") 
-                + currentFileNames[index]  + fileNamePostfix + LOG4CPLUS_TEXT(" to ")
-                + target);
-            long ret = file_rename(fileNames[index] + fileNamePostfix, target);
-            loglog_renaming_result(getLogLog(), fileNames[index] + fileNamePostfix, target, ret);
+
+            int fd = doOpenFile(currentFileNames[index], true, closeOnExec);
+            if (fd >= 0) 
+            {
+                std::vector<LogFilePtr> retired(1, logFiles[index]);
+                logFiles[index] = newLogFile(fd, currentFileNames[index], true);
+                resetLayout();
+                getBackgroundRotator().Retire(retired);
+            }
         }
     }
 
@@ -904,6 +1990,9 @@ bool DailyRollingFileAppender::checkAndRollover(size_t index)
     {
         nextRolloverTime = calculateNextRolloverTime(now);
 
+        // Buffers still holding the old files let go of them below, the
+        // rotator drops the last references off this thread.
+        std::vector<LogFilePtr> retired(logFiles);
         closeFiles();
         assert(!logFiles[index]);
 
@@ -939,6 +2028,7 @@ bool DailyRollingFileAppender::checkAndRollover(size_t index)
             buffers.push_back(*it);
             tmp_buffers.erase(it++);
         }
+        getBackgroundRotator().Retire(retired);
     } 
     else 
     {
@@ -961,39 +2051,24 @@ bool DailyRollingFileAppender::checkAndRollover(size_t index)
 
 Time DailyRollingFileAppender::calculateNextRolloverTime(const Time& t) const
 {
-    Time ret = t;
-    ret.usec(0);
     struct tm time;
-    t.localtime(&time);
+    breakDownTime(t.sec(), &time, false);
     time.tm_sec = 0;
 
     switch (schedule)
     {
     case MONTHLY: 
-    {
         time.tm_mday = 1;
         time.tm_hour = 0;
         time.tm_min = 0;
         time.tm_mon += 1;
-        time.tm_isdst = 0;
-
-        if (ret.setTime(&time) == -1) 
-        {
-            helpers::getLogLog().error(
-                "DailyRollingFileAppender::calculateNextRolloverTime()-"
-                " setTime() returned error");
-            ret = (t + Time(2678400));
-        }
-
-        return ret;
-    }
+        return Time(makeLocalTime(&time));
 
     case WEEKLY:
         time.tm_mday -= (time.tm_wday % 7);
         time.tm_hour = 0;
         time.tm_min = 0;
-        ret.setTime(&time);
-        return (ret + Time(7 * 24 * 60 * 60));
+        return (Time(makeLocalTime(&time)) + Time(7 * 24 * 60 * 60));
 
     default:
         helpers::getLogLog().error(
@@ -1003,8 +2078,7 @@ Time DailyRollingFileAppender::calculateNextRolloverTime(const Time& t) const
     case DAILY:
         time.tm_hour = 0;
         time.tm_min = 0;
-        ret.setTime(&time);
-        return (ret + Time(24 * 60 * 60));
+        return (Time(makeLocalTime(&time)) + Time(24 * 60 * 60));
 
     case TWICE_DAILY:
         if (time.tm_hour >= 12) 
@@ -1016,22 +2090,18 @@ Time DailyRollingFileAppender::calculateNextRolloverTime(const Time& t) const
             time.tm_hour = 0;
         }
         time.tm_min = 0;
-        ret.setTime(&time);
-        return (ret + Time(12 * 60 * 60));
+        return (Time(makeLocalTime(&time)) + Time(12 * 60 * 60));
 
     case HOURLY:
         time.tm_min = 0;
-        ret.setTime(&time);
-        return (ret + Time(60 * 60));
+        return (Time(makeLocalTime(&time)) + Time(60 * 60));
 
     case MINUTELY:
         {
-            ret += Time(60 * multiple);
-            ret.localtime(&time);
+            breakDownTime(t.sec() + 60 * multiple, &time, false);
             time.tm_sec = 0;
             time.tm_min = (time.tm_min / multiple) * multiple;
-            ret.setTime(&time);
-            return ret;
+            return Time(makeLocalTime(&time));
         }
     };
 }
@@ -1049,7 +2119,8 @@ std::vector<log4cplus::tstring> DailyRollingFileAppender::getFileNames() const
 
 tstring DailyRollingFileAppender::getFileName(size_t index) const
 {
-    Time now = Time::gettimeofday();
+    struct tm time;
+    breakDownTime(Time::gettimeofday().sec(), &time, false);
     tchar const * pattern = 0;
     switch (schedule)
     {
@@ -1080,17 +2151,13 @@ tstring DailyRollingFileAppender::getFileName(size_t index) const
 
     case MINUTELY:
         pattern = LOG4CPLUS_TEXT("%Y-%m-%d-%H-%M");
-        struct tm time;
-        now.localtime(&time);
-        time.tm_sec = 0;
         time.tm_min = (time.tm_min / multiple) * multiple;
-        now.setTime(&time);
         break;
     };
 
     tstring result (fileNames[index]);
     result += LOG4CPLUS_TEXT(".");
-    result += now.getFormattedTime(pattern, false);
+    result += formatTime(pattern, time);
 
     return result + fileNamePostfix;
 }
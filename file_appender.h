@@ -8,11 +8,24 @@
 #include <log4cplus/helpers/lockfile.h>
 #include <boost/thread.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <deque>
 #include <fstream>
 #include <memory>
+#include <ostream>
 #include <sstream>
+#include <streambuf>
+#include <string>
 #include <zlib.h>
 
+#ifdef SLOG_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef SLOG_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
 namespace slog 
 {
 
@@ -20,6 +33,15 @@ enum CompressType
 {
     kNoCompress = 0,
     kGzCompress = 1,
+    kZstdCompress = 2,
+    kLz4Compress = 3,
+};
+
+// How RollingFileAppender names its backups, see BackupNaming.
+enum BackupNaming 
+{
+    kIndexNaming = 0,
+    kSequenceNaming = 1,
 };
 
 class LogFile : boost::noncopyable 
@@ -27,6 +49,9 @@ class LogFile : boost::noncopyable
 public:
     LogFile(int fd) 
         : fd_(fd) 
+        , index_fd_(-1)
+        , size_(0)
+        , failed_(false)
     {
     }
 
@@ -36,6 +61,11 @@ public:
         {
             close(fd_); 
         }
+
+        if (index_fd_ >= 0) 
+        {
+            close(index_fd_); 
+        }
     }
 
     int fd() const 
@@ -43,8 +73,47 @@ public:
         return fd_; 
     }
 
+    // Takes ownership of the sidecar index written by WriteBlock().
+    void SetIndex(int fd) 
+    {
+        index_fd_ = fd;
+    }
+
+    // Bytes in the file as of the last Stat() plus what this process
+    // wrote since. Compression workers write concurrently.
+    off_t size() const 
+    {
+        return __atomic_load_n(&size_, __ATOMIC_RELAXED);
+    }
+
+    bool Stat();
+
+    // Set by compression workers when a write fails, the appender then
+    // reopens the file as it does after a failed flush.
+    void SetFailed() 
+    {
+        __atomic_store_n(&failed_, true, __ATOMIC_RELAXED);
+    }
+
+    bool failed() const 
+    {
+        return __atomic_load_n(&failed_, __ATOMIC_RELAXED);
+    }
+
+    ssize_t Write(const char* data, size_t size);
+
+    // Writes one independently decodable block and, when there is an
+    // index, records where it landed and the time range of its logs.
+    ssize_t WriteBlock(const char* data, size_t size, 
+        const log4cplus::helpers::Time& first, 
+        const log4cplus::helpers::Time& last);
+
 private:
     int fd_;
+    int index_fd_;
+    off_t size_;
+    bool failed_;
+    boost::mutex block_mutex_;
 };
 
 typedef boost::shared_ptr<LogFile> LogFilePtr;
@@ -71,20 +140,48 @@ public:
 
     void Extend();
 
+    void Reserve(size_t size) 
+    {
+        while (size_ < size) 
+        {
+            Extend();
+        }
+    }
+
 private:
     char* buf_;
     size_t size_;
     double factor_;
 };
 
+// Lets stream based layouts append to a LogBuffer's string in place.
+class AppendStreamBuf : public std::streambuf 
+{
+public:
+    explicit AppendStreamBuf(std::string& output)
+        : output_(output)
+    {
+    }
+
+protected:
+    virtual int_type overflow(int_type c);
+    virtual std::streamsize xsputn(const char* s, std::streamsize n);
+
+private:
+    std::string& output_;
+};
+
 class LogBuffer : boost::noncopyable 
 {
 public:
     LogBuffer(size_t max)
-        : max_(max)
+        : streambuf_(data_)
+        , stream_(&streambuf_)
+        , max_(max)
         , logs_(0)
         , index_(0) 
     {
+        data_.reserve(max + max / 4);
     }
 
     virtual ~LogBuffer() 
@@ -96,9 +193,35 @@ public:
         return stream_; 
     }
 
-    void AddLogCount() 
+    std::string& data() 
+    { 
+        return data_; 
+    }
+
+    void AddLog(const log4cplus::helpers::Time& timestamp) 
+    {
+        AddLogs(1, timestamp, timestamp);
+    }
+
+    // Logs may arrive slightly out of order, keep the earliest and latest.
+    void AddLogs(size_t logs, const log4cplus::helpers::Time& first, 
+        const log4cplus::helpers::Time& last) 
     {
-        logs_++; 
+        if (logs == 0) 
+        {
+            return;
+        }
+
+        if (logs_ == 0 || first < first_) 
+        {
+            first_ = first;
+        }
+
+        if (logs_ == 0 || last_ < last) 
+        {
+            last_ = last;
+        }
+        logs_ += logs; 
     }
 
     size_t GetLogCount() const 
@@ -106,6 +229,16 @@ public:
         return logs_; 
     }
 
+    const log4cplus::helpers::Time& GetFirstTime() const 
+    { 
+        return first_; 
+    }
+
+    const log4cplus::helpers::Time& GetLastTime() const 
+    { 
+        return last_; 
+    }
+
     void setfile(size_t log_index, const LogFilePtr& logfile) 
     { 
         index_ = log_index; 
@@ -122,16 +255,35 @@ public:
         return file_; 
     }
 
-    bool ShouldFlush() const;
+    bool ShouldFlush() const 
+    {
+        return data_.size() >= max_;
+    }
+
     virtual int Flush(bool force);
 
+    // Waits until everything flushed so far is on disk.
+    virtual void Drain() 
+    {
+    }
+
+    // Describes a negative Flush() result other than -1.
+    virtual const char* CompressError(int ret) const 
+    {
+        return zError(ret);
+    }
+
 protected:
     virtual void Clear();
 
 protected:
-    std::stringstream stream_;
+    std::string data_;
+    AppendStreamBuf streambuf_;
+    std::ostream stream_;
     size_t max_;
     size_t logs_;
+    log4cplus::helpers::Time first_;
+    log4cplus::helpers::Time last_;
     size_t index_;
     LogFilePtr file_;
 };
@@ -139,7 +291,7 @@ protected:
 class GzLogBuffer : public LogBuffer 
 {
 public:
-    GzLogBuffer(size_t max, size_t real_flush);
+    GzLogBuffer(size_t max, size_t real_flush, int level);
     virtual ~GzLogBuffer();
 
     virtual int Flush(bool force);
@@ -155,6 +307,76 @@ protected:
     z_stream strm_;
 };
 
+class ChunkCompressor;
+
+// Hands full buffers to the compression pool instead of deflating them on
+// the logging thread. Flush only moves the text into a queued chunk. In
+// parallel mode every CompressFlushSize bytes become a separate gzip member
+// so one appender can keep several workers busy.
+class AsyncGzLogBuffer : public LogBuffer 
+{
+public:
+    AsyncGzLogBuffer(size_t max, size_t real_flush, int level, bool parallel);
+    virtual ~AsyncGzLogBuffer();
+
+    virtual int Flush(bool force);
+    virtual void Drain();
+
+private:
+    boost::scoped_ptr<ChunkCompressor> compressor_;
+};
+
+#ifdef SLOG_HAVE_ZSTD
+// Every real_flush bytes of input end a zstd frame, like the gzip members
+// of GzLogBuffer. A positive window_log turns on long distance matching.
+class ZstdLogBuffer : public LogBuffer 
+{
+public:
+    ZstdLogBuffer(size_t max, size_t real_flush, int level, int window_log);
+    virtual ~ZstdLogBuffer();
+
+    virtual int Flush(bool force);
+    virtual const char* CompressError(int ret) const;
+
+protected:
+    virtual void Clear();
+
+protected:
+    size_t real_flush_;
+    size_t input_size_;
+    DynamicBuffer buffer_;
+    size_t offset_;
+    ZSTD_CCtx* cctx_;
+    const char* error_;
+};
+#endif
+
+#ifdef SLOG_HAVE_LZ4
+// Writes lz4 frames of about real_flush bytes of input each.
+class Lz4LogBuffer : public LogBuffer 
+{
+public:
+    Lz4LogBuffer(size_t max, size_t real_flush, int level);
+    virtual ~Lz4LogBuffer();
+
+    virtual int Flush(bool force);
+    virtual const char* CompressError(int ret) const;
+
+protected:
+    virtual void Clear();
+
+protected:
+    size_t real_flush_;
+    size_t input_size_;
+    DynamicBuffer buffer_;
+    size_t offset_;
+    LZ4F_cctx* cctx_;
+    LZ4F_preferences_t prefs_;
+    bool started_;
+    const char* error_;
+};
+#endif
+
 class LOG4CPLUS_EXPORT FileAppender : public log4cplus::Appender 
 {
 public:
@@ -164,6 +386,14 @@ public:
 
     virtual void close();
 
+    // Called by the background flusher every FlushInterval milliseconds.
+    void flushBuffers();
+
+    // The Appender setters are not virtual, these also make the loggers
+    // drop routes computed from the old threshold or filter.
+    void setThreshold(log4cplus::LogLevel th);
+    void setFilter(log4cplus::spi::FilterPtr f);
+
 protected:
     virtual void append(const log4cplus::spi::InternalLoggingEvent& event);
     virtual bool checkAndRollover(size_t index);
@@ -185,10 +415,14 @@ protected:
     }
 
     static int doOpenFile(const std::string& fname, bool append, bool cloexec);
+    LogFilePtr newLogFile(int fd, const std::string& fname, bool append) const;
     bool openFile(size_t index);
     bool openFiles();
+    bool reopenFailedFiles();
     void closeFile(size_t index);
     void closeFiles();
+    void resetLayout();
+    LogBuffer* newBuffer() const;
     bool FlushBuffer(const boost::shared_ptr<LogBuffer>& buffer, 
         bool force, bool unlock);
 
@@ -201,9 +435,15 @@ private:
 
 protected:
     bool immediateFlush;
+    int flushInterval;
     int reopenDelay;
     unsigned long bufferSize;
     unsigned long compressFlushSize;
+    int compressLevel;
+    int compressWindowLog;
+    int compressThreads;
+    bool compressParallel;
+    bool compressIndex;
     std::vector<log4cplus::tstring> fileNames;
     log4cplus::tstring fileNamePostfix;
     std::vector<log4cplus::tstring> currentFileNames;
@@ -220,20 +460,36 @@ class LOG4CPLUS_EXPORT RollingFileAppender : public slog::FileAppender
 public:
     RollingFileAppender(const log4cplus::tstring& filename, 
         long maxFileSize = 10 * 1024 * 1024,
-        int maxBackupIndex = 1, bool immediateFlush = true);
+        int maxBackupIndex = 1, bool immediateFlush = true,
+        BackupNaming naming = kIndexNaming);
     RollingFileAppender(const log4cplus::helpers::Properties& properties);
 
     virtual ~RollingFileAppender();
 
 protected:
     virtual bool checkAndRollover(size_t index);
+    void startRollover(const log4cplus::tstring& filename, 
+        const log4cplus::tstring& rolled, const log4cplus::tstring& tail);
+    void scanBackups(size_t index);
+    unsigned long nextSequence(size_t index) const;
+    void recoverRollovers();
+    void rolloverToSequence(size_t index);
 
 private:
-    LOG4CPLUS_PRIVATE void init(long maxFileSize, int maxBackupIndex);
+    LOG4CPLUS_PRIVATE void init(long maxFileSize, int maxBackupIndex, 
+        BackupNaming naming);
 
 protected:
     long maxFileSize;
     int maxBackupIndex;
+    unsigned statCount;
+    unsigned rolloverCount;
+
+    // BackupNaming=sequence names backups <file>.<n> with n only growing,
+    // these are the numbers per file, oldest first by mtime. They are
+    // scanned from disk once and kept up to date by the rollovers.
+    bool sequenceNaming;
+    std::vector<std::deque<unsigned long> > backups;
 };
 
 enum DailyRollingFileSchedule 
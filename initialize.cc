@@ -11,6 +11,7 @@
 
 #include "file_appender.h"
 #include "pattern_layout.h"
+#include "binary_layout.h"
 #include "logger_factory.h"
 
 namespace log4cplus 
@@ -62,6 +63,10 @@ void InitLogFactoryRegistry()
         new log4cplus::spi::FactoryTempl<slog::PatternLayout,
         log4cplus::spi::LayoutFactory>(LOG4CPLUS_TEXT("PatternLayout"))));
 
+    reg2.put(std::auto_ptr<log4cplus::spi::LayoutFactory>(
+        new log4cplus::spi::FactoryTempl<slog::BinaryLayout,
+        log4cplus::spi::LayoutFactory>(LOG4CPLUS_TEXT("BinaryLayout"))));
+
     spi::FilterFactoryRegistry& reg3 = spi::getFilterFactoryRegistry();
     reg3.put(std::auto_ptr<log4cplus::spi::FilterFactory>(
         new log4cplus::spi::FactoryTempl<log4cplus::spi::DenyAllFilter,
@@ -19,6 +19,11 @@ public:
             value->addReference();
         }
     }
+
+    static log4cplus::spi::LoggerImpl* impl(const log4cplus::Logger& logger)
+    {
+        return logger.*(&Logger::value);
+    }
 };
 
 } // namespace slog
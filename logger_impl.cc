@@ -3,6 +3,11 @@
 #include <algorithm>
 #include <log4cplus/spi/loggingevent.h>
 #include <log4cplus/helpers/loglog.h>
+#include <log4cplus/spi/filter.h>
+#include <log4cplus/loglevel.h>
+
+#include "pattern_layout.h"
+#include "reclaim.h"
 
 using namespace log4cplus;
 using namespace log4cplus::helpers;
@@ -10,28 +15,165 @@ using namespace log4cplus::helpers;
 namespace slog 
 {
 
-void LoggerImpl::callAppenders(const log4cplus::spi::InternalLoggingEvent& event)
+unsigned long LoggerImpl::instances = 0;
+unsigned long LoggerImpl::chainGeneration = 1;
+
+void LoggerImpl::invalidateChains()
 {
-    int writes = 0;
-    const LoggerImpl* c = this;
+    __atomic_add_fetch(&chainGeneration, 1, __ATOMIC_RELEASE);
+}
 
-    for (; NULL != c; c = (LoggerImpl *)c->parent.get()) 
+// Only filters whose decision depends on nothing but the level are
+// evaluated ahead of time, any other filter keeps the appender routed.
+static bool levelOnlyFilter(const spi::Filter* filter)
+{
+    return dynamic_cast<const spi::LogLevelRangeFilter*>(filter)
+        || dynamic_cast<const spi::LogLevelMatchFilter*>(filter)
+        || dynamic_cast<const spi::DenyAllFilter*>(filter);
+}
+
+static bool mayAccept(Appender* appender, const spi::InternalLoggingEvent& probe)
+{
+    if (!appender->isAsSevereAsThreshold(probe.getLogLevel()))
     {
-        log4cplus::spi::LoggerImpl* p = (log4cplus::spi::LoggerImpl *)c;
-        if ("root" == p->getName()) 
+        return false;
+    }
+
+    spi::FilterPtr filter = appender->getFilter();
+    for (; filter; filter = filter->next)
+    {
+        if (!levelOnlyFilter(filter.get()))
         {
-            writes += p->appendLoopOnAppenders(event);
+            return true;
         }
-        else 
+
+        spi::FilterResult result = filter->decide(probe);
+        if (result != spi::NEUTRAL)
         {
-            writes += c->appendLoopOnAppenders(event);
+            return result == spi::ACCEPT;
         }
+    }
 
-        if (!c->additive) 
+    return true;
+}
+
+bool LoggerImpl::Chain::current() const
+{
+    std::vector<Link>::const_iterator link = links.begin();
+    for (; link != links.end(); ++link)
+    {
+        if (__atomic_load_n(&link->logger->additive, __ATOMIC_RELAXED) != link->additive)
         {
-            break;
-        }   
-    } 
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const LoggerImpl::ListType& LoggerImpl::Chain::route(LogLevel level) const
+{
+    if (level >= TRACE_LOG_LEVEL && level <= FATAL_LOG_LEVEL && level % 10000 == 0)
+    {
+        return routes[level / 10000];
+    }
+
+    return appenders;
+}
+
+const LoggerImpl::Chain* LoggerImpl::buildChain(unsigned long generation)
+{
+    pthread_mutex_lock(&mutex_);
+
+    const Chain* chain = chain_;
+    if (NULL == chain || chain->generation != generation) 
+    {
+        Chain* c = new Chain();
+        c->generation = generation;
+
+        // getAllAppenders() is virtual, the root logger is not ours.
+        LoggerImpl* p = this;
+        for (; NULL != p; p = (LoggerImpl *)p->parent.get()) 
+        {
+            ListType l = ((log4cplus::spi::LoggerImpl *)p)->getAllAppenders();
+            c->appenders.insert(c->appenders.end(), l.begin(), l.end());
+
+            Link link;
+            link.logger = p;
+            link.additive = __atomic_load_n(&p->additive, __ATOMIC_RELAXED);
+            c->links.push_back(link);
+            if (!link.additive) 
+            {
+                break;
+            }
+        }
+
+        for (int i = 0; i < kRoutedLevels; i++)
+        {
+            spi::InternalLoggingEvent probe(getName(), i * 10000, tstring(), NULL, 0);
+            ListType::const_iterator it = c->appenders.begin();
+            for (; it != c->appenders.end(); ++it)
+            {
+                if (mayAccept(it->get(), probe))
+                {
+                    c->routes[i].push_back(*it);
+                }
+            }
+        }
+
+        const Chain* old = chain_;
+        __atomic_store_n(&chain_, c, __ATOMIC_RELEASE);
+        Retire(old);
+        chain = c;
+    }
+
+    pthread_mutex_unlock(&mutex_);
+
+    return chain;
+}
+
+void LoggerImpl::callAppenders(const log4cplus::spi::InternalLoggingEvent& event)
+{
+    ReadGuard guard;
+    unsigned long generation = __atomic_load_n(&chainGeneration, __ATOMIC_ACQUIRE);
+    const Chain* chain = __atomic_load_n(&chain_, __ATOMIC_ACQUIRE);
+    if (NULL == chain || chain->generation != generation) 
+    {
+        chain = buildChain(generation);
+    }
+    else if (!chain->current())
+    {
+        // A logger changed its additivity, every logger routing through
+        // it has to rebuild.
+        invalidateChains();
+        generation = __atomic_load_n(&chainGeneration, __ATOMIC_ACQUIRE);
+        chain = buildChain(generation);
+    }
+
+    FormatScope scope(event);
+    const ListType& appenders = chain->route(event.getLogLevel());
+    ListType::const_iterator it = appenders.begin();
+    for (; it != appenders.end(); ++it)
+    {
+        (*it)->doAppend(event);
+    }
+}
+
+LoggerImpl::~LoggerImpl()
+{
+    delete snapshot_;
+
+    delete chain_;
+
+    pthread_mutex_destroy(&mutex_);
+}
+
+void LoggerImpl::publish()
+{
+    const ListType* old = snapshot_;
+    __atomic_store_n(&snapshot_, new ListType(appenderList), __ATOMIC_RELEASE);
+    Retire(old);
+    invalidateChains();
 }
 
 void LoggerImpl::addAppender(log4cplus::SharedAppenderPtr newAppender)
@@ -43,38 +185,35 @@ void LoggerImpl::addAppender(log4cplus::SharedAppenderPtr newAppender)
         return;
     }
 
-    pthread_rwlock_wrlock(&rwlock_);
+    pthread_mutex_lock(&mutex_);
 
     ListType::iterator it = std::find(appenderList.begin(), 
         appenderList.end(), newAppender);
     if (it == appenderList.end()) 
     {
         appenderList.push_back(newAppender);
+        publish();
     }
 
-    pthread_rwlock_unlock(&rwlock_);
+    pthread_mutex_unlock(&mutex_);
 }
 
 AppenderAttachableImpl::ListType LoggerImpl::getAllAppenders()
 {
-    pthread_rwlock_rdlock(&rwlock_);
-
-    AppenderAttachableImpl::ListType l = appenderList;
-
-    pthread_rwlock_unlock(&rwlock_);
+    ReadGuard guard;
 
-    return l;
+    return *snapshot();
 }
 
 log4cplus::SharedAppenderPtr LoggerImpl::getAppender(
     const log4cplus::tstring& name)
 {
-    pthread_rwlock_rdlock(&rwlock_);
-
+    ReadGuard guard;
+    const ListType* list = snapshot();
     log4cplus::SharedAppenderPtr p(NULL);
 
-    ListType::iterator it = appenderList.begin();
-    for (; it != appenderList.end(); ++it)
+    ListType::const_iterator it = list->begin();
+    for (; it != list->end(); ++it)
     {
         if ((*it)->getName() == name) 
         {
@@ -82,18 +221,17 @@ log4cplus::SharedAppenderPtr LoggerImpl::getAppender(
         }
     }
 
-    pthread_rwlock_unlock(&rwlock_);
-
     return p;
 }
 
 void LoggerImpl::removeAllAppenders()
 {
-    pthread_rwlock_wrlock(&rwlock_);
+    pthread_mutex_lock(&mutex_);
 
     appenderList.erase(appenderList.begin(), appenderList.end());
+    publish();
 
-    pthread_rwlock_unlock(&rwlock_);
+    pthread_mutex_unlock(&mutex_);
 }
 
 void LoggerImpl::removeAppender(log4cplus::SharedAppenderPtr appender)
@@ -105,34 +243,33 @@ void LoggerImpl::removeAppender(log4cplus::SharedAppenderPtr appender)
         return;
     }
 
-    pthread_rwlock_wrlock(&rwlock_);
+    pthread_mutex_lock(&mutex_);
 
     ListType::iterator it = std::find(appenderList.begin(), 
         appenderList.end(), appender);
     if (it != appenderList.end()) 
     {
         appenderList.erase(it);
+        publish();
     }
 
-    pthread_rwlock_unlock(&rwlock_);
+    pthread_mutex_unlock(&mutex_);
 }
 
 int LoggerImpl::appendLoopOnAppenders(
     const log4cplus::spi::InternalLoggingEvent& event) const
 {
     int count = 0;
+    ReadGuard guard;
+    const ListType* list = snapshot();
 
-    pthread_rwlock_rdlock(const_cast<pthread_rwlock_t *>(&rwlock_));
-
-    ListType::const_iterator it = appenderList.begin();
-    for (; it != appenderList.end(); ++it)
+    ListType::const_iterator it = list->begin();
+    for (; it != list->end(); ++it)
     {
         ++count;
         (*it)->doAppend(event);
     }
 
-    pthread_rwlock_unlock(const_cast<pthread_rwlock_t *>(&rwlock_));
-
     return count;
 }
 
@@ -4,23 +4,35 @@
 #include <log4cplus/helpers/pointer.h>
 #include <log4cplus/spi/loggerimpl.h>
 #include <pthread.h>
+#include <vector>
 
 namespace slog 
 {
 
+// Appenders are read through an immutable snapshot that writers replace
+// under mutex_, so appending an event takes no lock. Readers hold a
+// ReadGuard and replaced snapshots are retired, see reclaim.h. The
+// appenders of the whole parent chain are flattened the same way and
+// rebuilt whenever chainGeneration moves, together with one list per
+// standard level holding only the appenders that may accept it. Replaced
+// chains are retired like snapshots. Every event also checks the additivity
+// of the chained loggers, one flag per logger, as setAdditivity() can't be
+// hooked. Appender thresholds and filters are not polled: the setters of
+// slog appenders call invalidateChains(), any other change to them must be
+// followed by it.
 class LoggerImpl : public log4cplus::spi::LoggerImpl 
 {
 public:
     LoggerImpl(const log4cplus::tstring& name, log4cplus::Hierarchy& h) 
         : log4cplus::spi::LoggerImpl(name, h) 
+        , snapshot_(new ListType())
+        , chain_(NULL)
     {
-        pthread_rwlock_init(&rwlock_, NULL);
+        pthread_mutex_init(&mutex_, NULL);
+        __atomic_add_fetch(&instances, 1, __ATOMIC_RELAXED);
     }
 
-    virtual ~LoggerImpl() 
-    { 
-        pthread_rwlock_destroy(&rwlock_); 
-    }
+    virtual ~LoggerImpl();
 
     virtual void callAppenders(const log4cplus::spi::InternalLoggingEvent& event);
     virtual void addAppender(log4cplus::SharedAppenderPtr newAppender);
@@ -30,8 +42,51 @@ public:
     virtual void removeAppender(log4cplus::SharedAppenderPtr appender);
     int appendLoopOnAppenders(const log4cplus::spi::InternalLoggingEvent& event) const;
 
+    static unsigned long created()
+    {
+        return __atomic_load_n(&instances, __ATOMIC_ACQUIRE);
+    }
+
+    static void invalidateChains();
+
 private:
-    pthread_rwlock_t rwlock_;
+    // TRACE_LOG_LEVEL through FATAL_LOG_LEVEL, 10000 apart.
+    static const int kRoutedLevels = 6;
+
+    // A logger walked by the chain and its additivity at the time,
+    // setAdditivity() is not virtual in log4cplus.
+    struct Link
+    {
+        LoggerImpl* logger;
+        bool additive;
+    };
+
+    struct Chain
+    {
+        unsigned long generation;
+        ListType appenders;
+        ListType routes[kRoutedLevels];
+        std::vector<Link> links;
+
+        bool current() const;
+        const ListType& route(log4cplus::LogLevel level) const;
+    };
+
+    const ListType* snapshot() const
+    {
+        return __atomic_load_n(&snapshot_, __ATOMIC_ACQUIRE);
+    }
+
+    void publish();
+    const Chain* buildChain(unsigned long generation);
+
+private:
+    pthread_mutex_t mutex_;
+    const ListType* snapshot_;
+    const Chain* chain_;
+
+    static unsigned long instances;
+    static unsigned long chainGeneration;
 };
 
 } // namespace slog
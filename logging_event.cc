@@ -0,0 +1,184 @@
+#include "logging_event.h"
+
+#include <log4cplus/thread/threads.h>
+#include <log4cplus/internal/internal.h>
+#include <boost/thread/tss.hpp>
+
+#include "slog.h"
+
+using namespace log4cplus;
+
+namespace slog 
+{
+
+static const tstring empty_message;
+
+namespace
+{
+
+// %t and %T text of the current thread, formatted once, and its context.
+// Events share the strings instead of formatting the thread id each time.
+struct ThreadData
+{
+    tstring thread;
+    tstring thread2;
+    LogContext context;
+};
+
+static ThreadData* getThreadData()
+{
+    static boost::thread_specific_ptr<ThreadData> data;
+    ThreadData* current = data.get();
+    if (NULL == current)
+    {
+        current = new ThreadData();
+        current->thread = thread::getCurrentThreadName();
+        current->thread2 = thread::getCurrentThreadName2();
+        current->context.reserve(8);
+        data.reset(current);
+    }
+
+    return current;
+}
+
+static LogContext::iterator findContext(LogContext& context, const tstring& key)
+{
+    LogContext::iterator it = context.begin();
+    for (; it != context.end(); ++it)
+    {
+        if (it->first == key)
+        {
+            break;
+        }
+    }
+
+    return it;
+}
+
+} // namespace
+
+void setThreadName(const std::string& name)
+{
+    getThreadData()->thread = name;
+}
+
+void putContext(const std::string& key, const std::string& value)
+{
+    LogContext& context = getThreadData()->context;
+    LogContext::iterator it = findContext(context, key);
+    if (it != context.end())
+    {
+        it->second = value;
+    }
+    else
+    {
+        context.push_back(std::make_pair(key, value));
+    }
+}
+
+void removeContext(const std::string& key)
+{
+    LogContext& context = getThreadData()->context;
+    LogContext::iterator it = findContext(context, key);
+    if (it != context.end())
+    {
+        context.erase(it);
+    }
+}
+
+void clearContext()
+{
+    getThreadData()->context.clear();
+}
+
+void LoggingEvent::setThreadData()
+{
+    const ThreadData* data = getThreadData();
+    thread = data->thread;
+    thread2 = data->thread2;
+    threadCached = true;
+    thread2Cached = true;
+    context_ = &data->context;
+}
+
+void LoggingEvent::detachThreadData()
+{
+    if (context_ != &ownContext_)
+    {
+        ownContext_ = *context_;
+        context_ = &ownContext_;
+    }
+}
+
+void LoggingEvent::setLoggingEvent(const tstring& logger, int level,
+    const tstring& msg, const char* filename, int lineno)
+{
+    spi::InternalLoggingEvent::setLoggingEvent(logger, level, msg, 
+        filename, lineno);
+    setThreadData();
+    record_.Clear();
+    deferred_ = false;
+}
+
+void LoggingEvent::setDeferredEvent(const tstring& logger, int level,
+    const char* filename, int lineno, const char* format, va_list ap)
+{
+    spi::InternalLoggingEvent::setLoggingEvent(logger, level, empty_message, 
+        filename, lineno);
+    setThreadData();
+    record_.Capture(format, ap);
+    deferred_ = true;
+}
+
+void LoggingEvent::setDecodedEvent(const tstring& logger, int level,
+    const char* filename, int lineno, const char* format, 
+    const char* args, size_t size, bool truncated)
+{
+    spi::InternalLoggingEvent::setLoggingEvent(logger, level, empty_message, 
+        filename, lineno);
+    deferred_ = record_.Assign(format, args, size, truncated);
+    renderMessage();
+}
+
+void LoggingEvent::setOrigin(const tstring& threadName, 
+    const helpers::Time& ts)
+{
+    timestamp = ts;
+    thread = threadName;
+    thread2 = threadName;
+    threadCached = true;
+    thread2Cached = true;
+    ndc.clear();
+    ndcCached = true;
+    mdc.clear();
+    mdcCached = true;
+    ownContext_.clear();
+    context_ = &ownContext_;
+}
+
+// Whether getMDCCopy() would return anything, found out without copying.
+bool LoggingEvent::hasMDC() const
+{
+    if (mdcCached)
+    {
+        return !mdc.empty();
+    }
+
+    const internal::per_thread_data* ptd = internal::get_ptd(false);
+
+    return ptd && !ptd->mdc_map.empty();
+}
+
+void LoggingEvent::renderMessage()
+{
+    if (!deferred_) 
+    {
+        return;
+    }
+
+    message.clear();
+    record_.Render(message);
+    deferred_ = false;
+}
+
+} // namespace slog
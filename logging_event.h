@@ -0,0 +1,78 @@
+#ifndef LOGGING_EVENT_H
+#define LOGGING_EVENT_H
+
+#include <log4cplus/spi/loggingevent.h>
+#include <utility>
+#include <vector>
+
+#include "binary_record.h"
+
+namespace slog 
+{
+
+// Key/value fields set with putContext(). A handful of entries is expected,
+// so they are kept in a flat array and searched linearly.
+typedef std::vector<std::pair<log4cplus::tstring, log4cplus::tstring> > LogContext;
+
+// Event produced by the slog front end. It can carry the raw arguments of a
+// printf style statement, the message text is then rendered on demand.
+class LoggingEvent : public log4cplus::spi::InternalLoggingEvent 
+{
+public:
+    LoggingEvent() 
+        : deferred_(false)
+        , context_(&ownContext_)
+    {
+    }
+
+    void setLoggingEvent(const log4cplus::tstring& logger, int level,
+        const log4cplus::tstring& msg, const char* filename, int lineno);
+    void setDeferredEvent(const log4cplus::tstring& logger, int level,
+        const char* filename, int lineno, const char* format, va_list ap);
+
+    void setDecodedEvent(const log4cplus::tstring& logger, int level,
+        const char* filename, int lineno, const char* format, 
+        const char* args, size_t size, bool truncated);
+    void setOrigin(const log4cplus::tstring& threadName, 
+        const log4cplus::helpers::Time& ts);
+
+    const BinaryRecord& record() const 
+    { 
+        return record_; 
+    }
+
+    bool deferred() const 
+    { 
+        return deferred_; 
+    }
+
+    const LogContext& context() const
+    {
+        return *context_;
+    }
+
+    bool hasMDC() const;
+
+    void renderMessage();
+
+    // Copies the context out of the logging thread, for events handed to
+    // another thread.
+    void detachThreadData();
+
+private:
+    LoggingEvent(const LoggingEvent&);
+    LoggingEvent& operator=(const LoggingEvent&);
+
+    void setThreadData();
+
+    BinaryRecord record_;
+    bool deferred_;
+    // The context of the logging thread, read in place while the event is
+    // dispatched there, or ownContext_ once detached.
+    const LogContext* context_;
+    LogContext ownContext_;
+};
+
+} // namespace slog
+
+#endif
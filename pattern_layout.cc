@@ -6,10 +6,17 @@
 #include <log4cplus/spi/loggingevent.h>
 #include <log4cplus/internal/internal.h>
 #include <log4cplus/internal/env.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include <pthread.h>
 #include <cstdlib>
 #include <iomanip>
+#include <map>
+#include <typeinfo>
 
 #include "pattern_layout.h"
+#include "time_util.h"
+#include "logging_event.h"
 
 using namespace log4cplus;
 using namespace log4cplus::helpers;
@@ -17,18 +24,87 @@ using namespace log4cplus::helpers;
 namespace
 {
 
-static log4cplus::tstring get_basename(const log4cplus::tstring& filename)
+static log4cplus::tstring::size_type get_basename_pos(const log4cplus::tstring& filename)
 {
     log4cplus::tchar const dir_sep(LOG4CPLUS_TEXT('/'));
     log4cplus::tstring::size_type pos = filename.rfind(dir_sep);
-    if (pos != log4cplus::tstring::npos)
+
+    return (pos != log4cplus::tstring::npos) ? pos + 1 : 0;
+}
+
+static log4cplus::tstring get_basename(const log4cplus::tstring& filename)
+{
+    return filename.substr(get_basename_pos(filename));
+}
+
+// Start of the last 'precision' components of a logger name.
+static log4cplus::tstring::size_type get_logger_pos(const log4cplus::tstring& name, 
+    int precision)
+{
+    if (precision <= 0)
     {
-        return filename.substr(pos + 1);
+        return 0;
     }
-    else
+
+    log4cplus::tstring::size_type end = name.length() - 1;
+    for (int i = precision; i > 0; --i)
     {
-        return filename;
+        end = name.rfind(LOG4CPLUS_TEXT('.'), end - 1);
+        if (end == log4cplus::tstring::npos)
+        {
+            return 0;
+        }
     }
+
+    return end + 1;
+}
+
+// The pid text is rebuilt in the child after fork(), when no other thread
+// can be reading it.
+struct ProcessIdText
+{
+    log4cplus::tstring value;
+
+    ProcessIdText()
+    {
+        log4cplus::helpers::convertIntegerToString(value, 
+            log4cplus::internal::get_process_id());
+        pthread_atfork(NULL, NULL, &ProcessIdText::refresh);
+    }
+
+    static void refresh();
+};
+
+static ProcessIdText& get_process_id_text()
+{
+    static ProcessIdText text;
+
+    return text;
+}
+
+void ProcessIdText::refresh()
+{
+    log4cplus::helpers::convertIntegerToString(get_process_id_text().value,
+        log4cplus::internal::get_process_id());
+}
+
+static void append_integer(log4cplus::tstring& out, long value)
+{
+    log4cplus::tchar buf[24];
+    log4cplus::tchar* p = buf + sizeof(buf) / sizeof(buf[0]);
+    unsigned long v = (value < 0) ? 0UL - value : value;
+    do
+    {
+        *--p = LOG4CPLUS_TEXT('0') + v % 10;
+        v /= 10;
+    } while (v);
+
+    if (value < 0)
+    {
+        *--p = LOG4CPLUS_TEXT('-');
+    }
+
+    out.append(p, buf + sizeof(buf) / sizeof(buf[0]));
 }
 
 } // namespace
@@ -73,12 +149,17 @@ class PatternConverter
 public:
     explicit PatternConverter(const FormattingInfo& info);
     virtual ~PatternConverter() {}
-    void formatAndAppend(tostream& output, 
-        const spi::InternalLoggingEvent& event);
 
     virtual void convert(tstring & result,
         const spi::InternalLoggingEvent& event) = 0;
 
+    // Describes the converter as a program step, converters rendered
+    // inline by the layout pick their own op code.
+    void compile(PatternOp& op);
+
+protected:
+    virtual void compileOp(PatternOp&) const {}
+
 private:
     int minLen;
     std::size_t maxLen;
@@ -87,6 +168,8 @@ private:
 
 typedef std::vector<pattern::PatternConverter*> PatternConverterList;
 
+static const std::size_t kMemoSize = 16;
+
 class LiteralPatternConverter : public PatternConverter
 {
 public:
@@ -97,6 +180,13 @@ public:
         result = str;
     }
 
+protected:
+    virtual void compileOp(PatternOp& op) const
+    {
+        op.code = OP_LITERAL;
+        op.text = str;
+    }
+
 private:
     tstring str;
 };
@@ -123,6 +213,9 @@ public:
     BasicPatternConverter(const FormattingInfo& info, Type type);
     virtual void convert(tstring& result, const spi::InternalLoggingEvent& event);
 
+protected:
+    virtual void compileOp(PatternOp& op) const;
+
 private:
     BasicPatternConverter(const BasicPatternConverter&);
     BasicPatternConverter& operator=(BasicPatternConverter&);
@@ -137,6 +230,17 @@ public:
     LoggerPatternConverter(const FormattingInfo& info, int precision);
     virtual void convert(tstring& result, const spi::InternalLoggingEvent& event);
 
+protected:
+    virtual void compileOp(PatternOp& op) const
+    {
+        op.code = OP_LOGGER;
+        op.precision = precision;
+        if (precision > 0)
+        {
+            op.memo.resize(kMemoSize);
+        }
+    }
+
 private:
     int precision;
 };
@@ -149,8 +253,18 @@ public:
     virtual void convert(tstring& result, const spi::InternalLoggingEvent& event);
 
 private:
+    void split();
+
     bool use_gmtime;
     tstring format;
+
+    // The format split around %q and %Q. The pieces go through strftime
+    // once per second, the sub-second fields are filled in for every event.
+    std::vector<tstring> pieces;
+    std::vector<tchar> fields;
+    std::vector<tstring> rendered;
+    helpers::time_t renderedSec;
+    bool hasRendered;
 };
 
 class EnvPatternConverter : public PatternConverter 
@@ -186,6 +300,16 @@ public:
     MDCPatternConverter(const FormattingInfo& info, tstring const &k);
     virtual void convert(tstring &result, const spi::InternalLoggingEvent& event);
 
+    static void append(tstring& result, const spi::InternalLoggingEvent& event,
+        const tstring& key);
+
+protected:
+    virtual void compileOp(PatternOp& op) const
+    {
+        op.code = OP_CONTEXT;
+        op.text = key;
+    }
+
 private:
     tstring key;
 };
@@ -251,32 +375,16 @@ PatternConverter::PatternConverter(const FormattingInfo& i)
     leftAlign = i.leftAlign;
 }
 
-void PatternConverter::formatAndAppend(tostream& output, 
-    const spi::InternalLoggingEvent& event)
+void PatternConverter::compile(PatternOp& op)
 {
-    tstring s;
-    convert(s, event);
-    std::size_t len = s.length();
-
-    if (len > maxLen)
-    {
-        output << s.substr(len - maxLen);
-    }
-    else if (static_cast<int>(len) < minLen)
-    {
-        std::ios_base::fmtflags const original_flags = output.flags();
-        tchar const fill = output.fill(LOG4CPLUS_TEXT(' '));
-        output.setf(leftAlign ? std::ios_base::left : std::ios_base::right,
-            std::ios_base::adjustfield);
-        output.width(minLen);
-        output << s;
-        output.fill(fill);
-        output.flags(original_flags);
-    }
-    else
-    {
-        output << s;
-    }
+    op.code = OP_CONVERTER;
+    op.minLen = minLen;
+    op.maxLen = maxLen;
+    op.leftAlign = leftAlign;
+    op.precision = 0;
+    op.text.clear();
+    op.converter = this;
+    compileOp(op);
 }
 
 LiteralPatternConverter::LiteralPatternConverter(const tstring& str_)
@@ -306,7 +414,7 @@ void BasicPatternConverter::convert(tstring &result,
         return;
 
     case PROCESS_CONVERTER:
-        helpers::convertIntegerToString(result, internal::get_process_id()); 
+        result = get_process_id_text().value;
         return;
 
     case NDC_CONVERTER:
@@ -372,6 +480,52 @@ void BasicPatternConverter::convert(tstring &result,
     result = LOG4CPLUS_TEXT("INTERNAL LOG4CPLUS ERROR");
 }
 
+void BasicPatternConverter::compileOp(PatternOp& op) const
+{
+    switch (type)
+    {
+    case LOGLEVEL_CONVERTER:
+        op.code = OP_LOGLEVEL;
+        break;
+
+    case MESSAGE_CONVERTER:
+        op.code = OP_MESSAGE;
+        break;
+
+    case NEWLINE_CONVERTER:
+        op.code = OP_NEWLINE;
+        break;
+
+    case BASENAME_CONVERTER:
+        op.code = OP_BASENAME;
+        op.memo.resize(kMemoSize);
+        break;
+
+    case PROCESS_CONVERTER:
+        op.code = OP_PROCESS;
+        break;
+
+    case FILE_CONVERTER:
+        op.code = OP_FILE;
+        break;
+
+    case THREAD_CONVERTER:
+        op.code = OP_THREAD;
+        break;
+
+    case THREAD2_CONVERTER:
+        op.code = OP_THREAD2;
+        break;
+
+    case LINE_CONVERTER:
+        op.code = OP_LINE;
+        break;
+
+    default:
+        break;
+    }
+}
+
 LoggerPatternConverter::LoggerPatternConverter(const FormattingInfo& info, int prec)
     : PatternConverter(info)
     , precision(prec)
@@ -382,41 +536,93 @@ void LoggerPatternConverter::convert(tstring &result,
     const spi::InternalLoggingEvent& event)
 {
     const tstring& name = event.getLoggerName();
-    if (precision <= 0) 
-    {
-        result = name;
-    }
-    else 
+    result.assign(name, get_logger_pos(name, precision), tstring::npos);
+}
+
+DatePatternConverter::DatePatternConverter(const FormattingInfo& info, 
+    const tstring& pattern, bool use_gmtime_)
+    : PatternConverter(info)
+    , use_gmtime(use_gmtime_)
+    , format(pattern)
+    , renderedSec(0)
+    , hasRendered(false)
+{
+    split();
+}
+
+void DatePatternConverter::split()
+{
+    tstring piece;
+    tstring::size_type i = 0;
+    while (i < format.size())
     {
-        std::size_t len = name.length();
-        tstring::size_type end = len - 1;
-        for (int i = precision; i > 0; --i)
+        tchar c = format[i++];
+        if (c != LOG4CPLUS_TEXT('%') || i == format.size())
         {
-            end = name.rfind(LOG4CPLUS_TEXT('.'), end - 1);
-            if (end == tstring::npos) 
-            {
-                result = name;
+            piece += c;
 
-                return;
-            }
+            continue;
         }
 
-        result = name.substr(end + 1);
+        tchar spec = format[i++];
+        if (spec == LOG4CPLUS_TEXT('q') || spec == LOG4CPLUS_TEXT('Q'))
+        {
+            pieces.push_back(piece);
+            fields.push_back(spec);
+            piece.clear();
+        }
+        else
+        {
+            piece += c;
+            piece += spec;
+        }
     }
+
+    pieces.push_back(piece);
+    rendered.resize(pieces.size());
 }
 
-DatePatternConverter::DatePatternConverter(const FormattingInfo& info, 
-    const tstring& pattern, bool use_gmtime_)
-    : PatternConverter(info)
-    , use_gmtime(use_gmtime_)
-    , format(pattern)
+static void append_digits(tstring& out, int value, int width)
 {
+    tchar buf[8];
+    for (int i = width - 1; i >= 0; --i)
+    {
+        buf[i] = LOG4CPLUS_TEXT('0') + value % 10;
+        value /= 10;
+    }
+
+    out.append(buf, width);
 }
 
 void DatePatternConverter::convert(tstring &result,
     const spi::InternalLoggingEvent& event)
 {
-    result = event.getTimestamp().getFormattedTime(format, use_gmtime);
+    const helpers::Time& ts = event.getTimestamp();
+    if (!hasRendered || ts.sec() != renderedSec)
+    {
+        struct tm time;
+        breakDownTime(ts.sec(), &time, use_gmtime);
+        for (std::size_t i = 0; i < pieces.size(); i++)
+        {
+            rendered[i] = formatTime(pieces[i], time);
+        }
+
+        renderedSec = ts.sec();
+        hasRendered = true;
+    }
+
+    result = rendered[0];
+    int usec = ts.usec();
+    for (std::size_t i = 0; i < fields.size(); i++)
+    {
+        append_digits(result, usec / 1000, 3);
+        if (fields[i] == LOG4CPLUS_TEXT('Q'))
+        {
+            result += LOG4CPLUS_TEXT('.');
+            append_digits(result, usec % 1000, 3);
+        }
+        result += rendered[i + 1];
+    }
 }
 
 EnvPatternConverter::EnvPatternConverter(const FormattingInfo& info, 
@@ -475,28 +681,79 @@ pattern::MDCPatternConverter::MDCPatternConverter(const FormattingInfo& info, ts
 void pattern::MDCPatternConverter::convert(tstring &result,
     const spi::InternalLoggingEvent& event)
 {
-    if (!key.empty())
+    result.clear();
+    append(result, event, key);
+}
+
+// The slog context is read straight from the event, the log4cplus MDC map
+// is only consulted when the event has one.
+void pattern::MDCPatternConverter::append(tstring &result,
+    const spi::InternalLoggingEvent& event, const tstring& key)
+{
+    const LogContext* context = NULL;
+    bool mdc = true;
+    if (typeid(event) == typeid(LoggingEvent))
     {
-        result = event.getMDC(key);
+        const LoggingEvent& sev = static_cast<const LoggingEvent&>(event);
+        context = &sev.context();
+        mdc = sev.hasMDC();
     }
-    else
+
+    if (!key.empty())
     {
-        result.clear();
+        if (context)
+        {
+            LogContext::const_iterator it = context->begin();
+            for (; it != context->end(); ++it)
+            {
+                if (it->first == key)
+                {
+                    result += it->second;
+
+                    return;
+                }
+            }
+        }
+
+        if (mdc)
+        {
+            result += event.getMDC(key);
+        }
 
-        MappedDiagnosticContextMap const &mdcMap = event.getMDCCopy();
-        for (MappedDiagnosticContextMap::const_iterator it = mdcMap.begin(); 
-             it != mdcMap.end(); ++it)
-        {           
-            tstring const &name(it->first);
-            tstring const &value(it->second);
+        return;
+    }
 
+    if (context)
+    {
+        LogContext::const_iterator it = context->begin();
+        for (; it != context->end(); ++it)
+        {
             result += LOG4CPLUS_TEXT("{");
-            result += name;
+            result += it->first;
             result += LOG4CPLUS_TEXT(", ");
-            result += value;
-            result += LOG4CPLUS_TEXT("}"); 
+            result += it->second;
+            result += LOG4CPLUS_TEXT("}");
         }
     }
+
+    if (!mdc)
+    {
+        return;
+    }
+
+    MappedDiagnosticContextMap const &mdcMap = event.getMDCCopy();
+    for (MappedDiagnosticContextMap::const_iterator it = mdcMap.begin(); 
+         it != mdcMap.end(); ++it)
+    {           
+        tstring const &name(it->first);
+        tstring const &value(it->second);
+
+        result += LOG4CPLUS_TEXT("{");
+        result += name;
+        result += LOG4CPLUS_TEXT(", ");
+        result += value;
+        result += LOG4CPLUS_TEXT("}"); 
+    }
 }
 
 pattern::NDCPatternConverter::NDCPatternConverter(const FormattingInfo& info, int precision_)
@@ -819,12 +1076,84 @@ void PatternParser::finalizeConverter(tchar c)
 
 typedef pattern::PatternConverterList PatternConverterList;
 
+namespace
+{
+
+// Layouts with the same pattern share an id. The user counts are never
+// freed so a layout can read its count without taking the lock.
+struct PatternRegistry
+{
+    boost::mutex mutex;
+    std::map<tstring, std::pair<int, int*> > patterns;
+};
+
+static PatternRegistry& getPatternRegistry()
+{
+    static PatternRegistry registry;
+
+    return registry;
+}
+
+struct FormatCache
+{
+    struct Entry
+    {
+        int patternId;
+        tstring text;
+    };
+
+    unsigned long serial;
+    size_t used;
+    std::vector<Entry> entries;
+
+    FormatCache()
+        : serial(0)
+        , used(0)
+    {
+    }
+};
+
+static FormatCache* getFormatCache()
+{
+    static boost::thread_specific_ptr<FormatCache> caches;
+    FormatCache* cache = caches.get();
+    if (NULL == cache)
+    {
+        cache = new FormatCache();
+        caches.reset(cache);
+    }
+
+    return cache;
+}
+
+static __thread const spi::InternalLoggingEvent* currentEvent = NULL;
+static __thread unsigned long currentSerial = 0;
+
+} // namespace
+
+FormatScope::FormatScope(const spi::InternalLoggingEvent& event)
+    : previous_(currentEvent)
+{
+    currentEvent = &event;
+    ++currentSerial;
+}
+
+FormatScope::~FormatScope()
+{
+    currentEvent = previous_;
+    ++currentSerial;
+}
+
 PatternLayout::PatternLayout(const tstring& pattern_)
+    : patternId(0)
+    , patternUsers(NULL)
 {
     init(pattern_, 0);
 }
 
 PatternLayout::PatternLayout(const helpers::Properties& properties)
+    : patternId(0)
+    , patternUsers(NULL)
 {
     unsigned ndcMaxDepth = 0;
     properties.getUInt(ndcMaxDepth, LOG4CPLUS_TEXT("NDCMaxDepth"));
@@ -858,6 +1187,24 @@ PatternLayout::PatternLayout(const helpers::Properties& properties)
 void PatternLayout::init(const tstring& pattern_, unsigned ndcMaxDepth)
 {
     pattern = pattern_;
+
+    PatternRegistry& registry = getPatternRegistry();
+    tstring key = pattern + LOG4CPLUS_TEXT('\0') 
+        + helpers::convertIntegerToString(ndcMaxDepth);
+    {
+        boost::mutex::scoped_lock lock(registry.mutex);
+        std::pair<int, int*>& entry = registry.patterns[key];
+        if (NULL == entry.second)
+        {
+            entry.first = registry.patterns.size();
+            entry.second = new int(0);
+        }
+
+        patternId = entry.first;
+        patternUsers = entry.second;
+        __atomic_add_fetch(patternUsers, 1, __ATOMIC_RELAXED);
+    }
+
     parsedPattern = pattern::PatternParser(pattern, ndcMaxDepth).parse();
     PatternConverterList::iterator it = parsedPattern.begin();
     for (; it != parsedPattern.end(); ++it)
@@ -878,10 +1225,39 @@ void PatternLayout::init(const tstring& pattern_, unsigned ndcMaxDepth)
             new pattern::BasicPatternConverter(pattern::FormattingInfo(), 
             pattern::BasicPatternConverter::MESSAGE_CONVERTER));
     }
+
+    compile();
+}
+
+void PatternLayout::compile()
+{
+    program.clear();
+    PatternConverterList::iterator it = parsedPattern.begin();
+    for (; it != parsedPattern.end(); ++it)
+    {
+        pattern::PatternOp op;
+        (*it)->compile(op);
+
+        // Adjacent unpadded literals are merged into one append.
+        if (op.code == pattern::OP_LITERAL && !program.empty()
+            && program.back().code == pattern::OP_LITERAL)
+        {
+            program.back().text += op.text;
+
+            continue;
+        }
+
+        program.push_back(op);
+    }
 }
 
 PatternLayout::~PatternLayout()
 {
+    if (patternUsers)
+    {
+        __atomic_sub_fetch(patternUsers, 1, __ATOMIC_RELAXED);
+    }
+
     PatternConverterList::iterator it = parsedPattern.begin();
     for (; it != parsedPattern.end(); ++it)
     {
@@ -889,14 +1265,175 @@ PatternLayout::~PatternLayout()
     }
 }
 
+// Direct mapped cache of name offsets. A hit costs a full string compare,
+// except that with the reference counted std::string of the old libstdc++
+// ABI a logger name still shares the logger's buffer and is found by the
+// data() compare. File names are copied into every event and are always
+// compared in full.
+static std::size_t memoized(std::vector<pattern::PatternMemo>& memo,
+    const tstring& key, int precision)
+{
+    if (memo.empty())
+    {
+        return (precision < 0) ? 
+            get_basename_pos(key) : get_logger_pos(key, precision);
+    }
+
+    std::size_t hash = key.size();
+    if (!key.empty())
+    {
+        hash = hash * 31 + key[key.size() / 2] * 7 + key[key.size() - 1];
+    }
+
+    pattern::PatternMemo& m = memo[hash % memo.size()];
+    if (m.key.data() != key.data() && m.key != key)
+    {
+        m.key = key;
+        m.pos = (precision < 0) ? 
+            get_basename_pos(key) : get_logger_pos(key, precision);
+    }
+
+    return m.pos;
+}
+
+void PatternLayout::format(tstring& output, 
+    const spi::InternalLoggingEvent& event)
+{
+    std::vector<pattern::PatternOp>::iterator op = program.begin();
+    for (; op != program.end(); ++op)
+    {
+        std::size_t start = output.size();
+        switch (op->code)
+        {
+        case pattern::OP_LITERAL:
+            output += op->text;
+            break;
+
+        case pattern::OP_MESSAGE:
+            output += event.getMessage();
+            break;
+
+        case pattern::OP_LOGLEVEL:
+            output += getLogLevelManager().toString(event.getLogLevel());
+            break;
+
+        case pattern::OP_LOGGER:
+            {
+                const tstring& name = event.getLoggerName();
+                output.append(name, memoized(op->memo, name, op->precision), 
+                    tstring::npos);
+            }
+            break;
+
+        case pattern::OP_THREAD:
+            output += event.getThread();
+            break;
+
+        case pattern::OP_THREAD2:
+            output += event.getThread2();
+            break;
+
+        case pattern::OP_NEWLINE:
+            output += LOG4CPLUS_TEXT('\n');
+            break;
+
+        case pattern::OP_FILE:
+            output += event.getFile();
+            break;
+
+        case pattern::OP_BASENAME:
+            {
+                const tstring& file = event.getFile();
+                output.append(file, memoized(op->memo, file, -1), tstring::npos);
+            }
+            break;
+
+        case pattern::OP_LINE:
+            if (event.getLine() != -1)
+            {
+                append_integer(output, event.getLine());
+            }
+            break;
+
+        case pattern::OP_PROCESS:
+            output += get_process_id_text().value;
+            break;
+
+        case pattern::OP_CONTEXT:
+            pattern::MDCPatternConverter::append(output, event, op->text);
+            break;
+
+        case pattern::OP_CONVERTER:
+            op->converter->convert(scratch, event);
+            output += scratch;
+            break;
+        }
+
+        std::size_t len = output.size() - start;
+        if (len > op->maxLen)
+        {
+            output.erase(start, len - op->maxLen);
+        }
+        else if (static_cast<int>(len) < op->minLen)
+        {
+            if (op->leftAlign)
+            {
+                output.append(op->minLen - len, LOG4CPLUS_TEXT(' '));
+            }
+            else
+            {
+                output.insert(start, op->minLen - len, LOG4CPLUS_TEXT(' '));
+            }
+        }
+    }
+}
+
 void PatternLayout::formatAndAppend(tostream& output, 
     const spi::InternalLoggingEvent& event)
 {
-    PatternConverterList::iterator it = parsedPattern.begin();
-    for (; it != parsedPattern.end(); ++it)
+    buffer.clear();
+    formatAndAppend(buffer, event);
+    output.write(buffer.data(), buffer.size());
+}
+
+void PatternLayout::formatAndAppend(tstring& output, 
+    const spi::InternalLoggingEvent& event)
+{
+    if (currentEvent != &event || NULL == patternUsers
+        || __atomic_load_n(patternUsers, __ATOMIC_RELAXED) < 2)
+    {
+        format(output, event);
+
+        return;
+    }
+
+    FormatCache* cache = getFormatCache();
+    if (cache->serial != currentSerial)
     {
-        (*it)->formatAndAppend(output, event);
+        cache->serial = currentSerial;
+        cache->used = 0;
     }
+
+    for (size_t i = 0; i < cache->used; i++)
+    {
+        if (cache->entries[i].patternId == patternId)
+        {
+            output += cache->entries[i].text;
+
+            return;
+        }
+    }
+
+    if (cache->used == cache->entries.size())
+    {
+        cache->entries.resize(cache->used + 1);
+    }
+
+    FormatCache::Entry& entry = cache->entries[cache->used++];
+    entry.patternId = patternId;
+    entry.text.clear();
+    format(entry.text, event);
+    output += entry.text;
 }
 
 } // namespace log4cplus
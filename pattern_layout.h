@@ -8,8 +8,60 @@ namespace slog
 
 namespace pattern 
 {
-    class PatternConverter;
-}
+
+class PatternConverter;
+
+enum PatternOpCode
+{
+    OP_LITERAL,
+    OP_MESSAGE,
+    OP_LOGLEVEL,
+    OP_LOGGER,
+    OP_THREAD,
+    OP_THREAD2,
+    OP_NEWLINE,
+    OP_FILE,
+    OP_BASENAME,
+    OP_LINE,
+    OP_PROCESS,
+    OP_CONTEXT,
+    OP_CONVERTER
+};
+
+// Remembers where the interesting part of a logger or file name starts.
+struct PatternMemo
+{
+    log4cplus::tstring key;
+    std::size_t pos;
+};
+
+// One step of a compiled pattern. Converters without a dedicated op code
+// are called through OP_CONVERTER.
+struct PatternOp
+{
+    PatternOpCode code;
+    int minLen;
+    std::size_t maxLen;
+    bool leftAlign;
+    int precision;
+    log4cplus::tstring text;
+    PatternConverter* converter;
+    std::vector<PatternMemo> memo;
+};
+
+} // namespace pattern
+
+// Marks the event being dispatched to the appenders on this thread. While
+// the scope is open, layouts with an identical pattern render it only once.
+class FormatScope
+{
+public:
+    explicit FormatScope(const log4cplus::spi::InternalLoggingEvent& event);
+    ~FormatScope();
+
+private:
+    const log4cplus::spi::InternalLoggingEvent* previous_;
+};
 
 class PatternLayout : public log4cplus::Layout 
 {
@@ -20,12 +72,22 @@ public:
 
     virtual void formatAndAppend(log4cplus::tostream& output, 
         const log4cplus::spi::InternalLoggingEvent& event);
+    void formatAndAppend(log4cplus::tstring& output, 
+        const log4cplus::spi::InternalLoggingEvent& event);
 
 protected:
     void init(const log4cplus::tstring& pattern, unsigned ndcMaxDepth = 0);
+    void compile();
+    void format(log4cplus::tstring& output,
+        const log4cplus::spi::InternalLoggingEvent& event);
 
     log4cplus::tstring pattern;
     std::vector<pattern::PatternConverter*> parsedPattern;
+    std::vector<pattern::PatternOp> program;
+    log4cplus::tstring buffer;
+    log4cplus::tstring scratch;
+    int patternId;
+    int* patternUsers;
 
 private: 
     PatternLayout(const PatternLayout&);
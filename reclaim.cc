@@ -0,0 +1,222 @@
+#include "reclaim.h"
+
+#include <boost/thread/tss.hpp>
+#include <climits>
+#include <pthread.h>
+#include <vector>
+
+namespace slog
+{
+
+// One per thread, reused once its thread is gone. epoch is the global epoch
+// seen when the outermost guard opened, 0 while no guard is open.
+struct ReclaimSlot
+{
+    unsigned long epoch;
+    unsigned long depth;
+    bool used;
+    ReclaimSlot* next;
+};
+
+namespace
+{
+
+struct Retired
+{
+    const void* p;
+    Deleter deleter;
+    unsigned long epoch;
+};
+
+class Reclaimer : boost::noncopyable
+{
+public:
+    Reclaimer()
+        : epoch_(1)
+        , pending_(0)
+        , slots_(NULL)
+    {
+        pthread_mutex_init(&mutex_, NULL);
+    }
+
+    ReclaimSlot* Acquire();
+    void Release(ReclaimSlot* slot);
+
+    void Enter(ReclaimSlot* slot);
+    void Leave(ReclaimSlot* slot);
+    void Retire(const void* p, Deleter deleter);
+
+private:
+    void Reclaim(bool wait);
+
+    unsigned long epoch_;
+    unsigned long pending_;
+    ReclaimSlot* slots_;
+    pthread_mutex_t mutex_;
+    std::vector<Retired> retired_;
+};
+
+static Reclaimer& getReclaimer()
+{
+    static Reclaimer* reclaimer = new Reclaimer();
+
+    return *reclaimer;
+}
+
+static void releaseSlot(ReclaimSlot* slot)
+{
+    getReclaimer().Release(slot);
+}
+
+static ReclaimSlot* getSlot()
+{
+    static boost::thread_specific_ptr<ReclaimSlot> slot(&releaseSlot);
+    ReclaimSlot* current = slot.get();
+    if (NULL == current)
+    {
+        current = getReclaimer().Acquire();
+        slot.reset(current);
+    }
+
+    return current;
+}
+
+ReclaimSlot* Reclaimer::Acquire()
+{
+    ReclaimSlot* slot = __atomic_load_n(&slots_, __ATOMIC_ACQUIRE);
+    for (; slot; slot = slot->next)
+    {
+        if (!__atomic_test_and_set(&slot->used, __ATOMIC_ACQUIRE))
+        {
+            return slot;
+        }
+    }
+
+    slot = new ReclaimSlot();
+    slot->epoch = 0;
+    slot->depth = 0;
+    slot->used = true;
+    slot->next = __atomic_load_n(&slots_, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&slots_, &slot->next, slot, true,
+        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+    }
+
+    return slot;
+}
+
+void Reclaimer::Release(ReclaimSlot* slot)
+{
+    __atomic_clear(&slot->used, __ATOMIC_RELEASE);
+}
+
+void Reclaimer::Enter(ReclaimSlot* slot)
+{
+    if (slot->depth++ > 0)
+    {
+        return;
+    }
+
+    // Pairs with the increment in Retire(): either the writer sees this
+    // slot open or this reader sees the unlinked pointer.
+    __atomic_store_n(&slot->epoch, __atomic_load_n(&epoch_, __ATOMIC_SEQ_CST),
+        __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void Reclaimer::Leave(ReclaimSlot* slot)
+{
+    if (--slot->depth > 0)
+    {
+        return;
+    }
+
+    __atomic_store_n(&slot->epoch, 0, __ATOMIC_RELEASE);
+    if (__atomic_load_n(&pending_, __ATOMIC_RELAXED) > 0)
+    {
+        Reclaim(false);
+    }
+}
+
+void Reclaimer::Retire(const void* p, Deleter deleter)
+{
+    Retired r;
+    r.p = p;
+    r.deleter = deleter;
+    r.epoch = __atomic_fetch_add(&epoch_, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&mutex_);
+    retired_.push_back(r);
+    __atomic_store_n(&pending_, retired_.size(), __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&mutex_);
+
+    Reclaim(true);
+}
+
+// Frees what no open guard can reach. The slots are scanned under mutex_
+// so that every listed object was unlinked before the scan started.
+void Reclaimer::Reclaim(bool wait)
+{
+    if (wait)
+    {
+        pthread_mutex_lock(&mutex_);
+    }
+    else if (pthread_mutex_trylock(&mutex_) != 0)
+    {
+        return;
+    }
+
+    unsigned long oldest = ULONG_MAX;
+    ReclaimSlot* slot = __atomic_load_n(&slots_, __ATOMIC_ACQUIRE);
+    for (; slot; slot = slot->next)
+    {
+        unsigned long epoch = __atomic_load_n(&slot->epoch, __ATOMIC_SEQ_CST);
+        if (epoch != 0 && epoch < oldest)
+        {
+            oldest = epoch;
+        }
+    }
+
+    std::vector<Retired> freed;
+    std::vector<Retired>::iterator it = retired_.begin();
+    while (it != retired_.end())
+    {
+        if (it->epoch < oldest)
+        {
+            freed.push_back(*it);
+            it = retired_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    __atomic_store_n(&pending_, retired_.size(), __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&mutex_);
+
+    for (size_t i = 0; i < freed.size(); i++)
+    {
+        freed[i].deleter(freed[i].p);
+    }
+}
+
+} // namespace
+
+ReadGuard::ReadGuard()
+    : slot_(getSlot())
+{
+    getReclaimer().Enter(slot_);
+}
+
+ReadGuard::~ReadGuard()
+{
+    getReclaimer().Leave(slot_);
+}
+
+void Retire(const void* p, Deleter deleter)
+{
+    getReclaimer().Retire(p, deleter);
+}
+
+} // namespace slog
@@ -0,0 +1,46 @@
+#ifndef RECLAIM_H
+#define RECLAIM_H
+
+#include <boost/noncopyable.hpp>
+
+namespace slog
+{
+
+struct ReclaimSlot;
+
+// Epoch based reclamation for data that readers walk without a lock.
+// Readers stay inside a ReadGuard while they hold a pointer they loaded,
+// writers unlink an object first and then Retire() it. The object is freed
+// once no guard that was open at retirement is still open.
+class ReadGuard : boost::noncopyable
+{
+public:
+    ReadGuard();
+    ~ReadGuard();
+
+private:
+    ReclaimSlot* slot_;
+};
+
+typedef void (*Deleter)(const void* p);
+
+void Retire(const void* p, Deleter deleter);
+
+template <typename T>
+void DeleteRetired(const void* p)
+{
+    delete static_cast<const T*>(p);
+}
+
+template <typename T>
+void Retire(const T* p)
+{
+    if (p)
+    {
+        Retire(p, &DeleteRetired<T>);
+    }
+}
+
+} // namespace slog
+
+#endif
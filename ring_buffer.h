@@ -0,0 +1,127 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <boost/noncopyable.hpp>
+#include <cstddef>
+
+namespace slog
+{
+
+// Bounded multi-producer single-consumer ring. Every cell carries a sequence
+// number, producers claim a cell with one CAS on the tail and publish it by
+// bumping the cell sequence, so they never wait on each other or the consumer.
+template <typename T>
+class MpscRing : boost::noncopyable
+{
+public:
+    explicit MpscRing(size_t capacity)
+        : capacity_(RoundUp(capacity))
+        , mask_(capacity_ - 1)
+        , cells_(new Cell[capacity_])
+        , tail_(0)
+        , head_(0)
+    {
+        for (size_t i = 0; i < capacity_; i++)
+        {
+            cells_[i].seq = i;
+        }
+    }
+
+    ~MpscRing()
+    {
+        delete[] cells_;
+    }
+
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    T* TryClaim(size_t* ticket)
+    {
+        size_t pos = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+        for (;;)
+        {
+            Cell& cell = cells_[pos & mask_];
+            size_t seq = __atomic_load_n(&cell.seq, __ATOMIC_ACQUIRE);
+            long diff = (long)seq - (long)pos;
+            if (diff == 0)
+            {
+                if (__atomic_compare_exchange_n(&tail_, &pos, pos + 1, true,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                {
+                    *ticket = pos;
+
+                    return &cell.value;
+                }
+            }
+            else if (diff < 0)
+            {
+                return NULL;
+            }
+            else
+            {
+                pos = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    void Publish(size_t ticket)
+    {
+        __atomic_store_n(&cells_[ticket & mask_].seq, ticket + 1,
+            __ATOMIC_RELEASE);
+    }
+
+    T* Front()
+    {
+        Cell& cell = cells_[head_ & mask_];
+        if (__atomic_load_n(&cell.seq, __ATOMIC_ACQUIRE) != head_ + 1)
+        {
+            return NULL;
+        }
+
+        return &cell.value;
+    }
+
+    void Pop()
+    {
+        __atomic_store_n(&cells_[head_ & mask_].seq, head_ + capacity_,
+            __ATOMIC_RELEASE);
+        head_++;
+    }
+
+    bool Empty() const
+    {
+        return __atomic_load_n(&tail_, __ATOMIC_ACQUIRE) == head_;
+    }
+
+private:
+    struct Cell
+    {
+        size_t seq;
+        T value;
+    };
+
+    static size_t RoundUp(size_t n)
+    {
+        size_t r = 2;
+        while (r < n)
+        {
+            r <<= 1;
+        }
+
+        return r;
+    }
+
+    size_t capacity_;
+    size_t mask_;
+    Cell* cells_;
+    char pad0_[64];
+    size_t tail_;
+    char pad1_[64];
+    size_t head_;
+};
+
+} // namespace slog
+
+#endif
@@ -11,9 +11,15 @@
 #include <log4cplus/socketappender.h>
 #include <log4cplus/hierarchy.h>
 #include <log4cplus/ndc.h>
+#include <log4cplus/spi/loggerimpl.h>
+#include <boost/thread/tss.hpp>
 
 #include "slog.h"
 #include "configurator.h"
+#include "async_logger.h"
+#include "logger.h"
+#include "logger_impl.h"
+#include "logging_event.h"
 
 using namespace std;
 using namespace log4cplus;
@@ -26,6 +32,10 @@ namespace slog
 typedef std::pair<std::string, std::string> KeyValue;
 typedef std::vector<KeyValue> ConfigList;
 
+const unsigned long kLogSiteBusy = ~0UL;
+
+unsigned long logGeneration = 0;
+
 void initializeLog();
 static void sLogConfig(ConfigList& clist);
 static bool isAppenderInit = false;
@@ -45,6 +55,7 @@ static bool reConfig(const Properties& props)
         return false;
     }
 
+    slog::getAsyncLogger().Stop();
     log4cplus::Logger::getRoot().getDefaultHierarchy().resetConfiguration();
     slog::PropertyConfigurator pc(props);
     pc.configure();
@@ -153,39 +164,186 @@ static void sLogConfig(ConfigList& clist)
     reConfig(props);
 }
 
-static bool needLog(const std::string& name, int level)
+LoggerHandle getLogger(const std::string& name)
 {
     init();
 
+    // A new logger may become the parent of existing ones, their
+    // flattened appender chains must be rebuilt once it is linked in.
+    unsigned long created = LoggerImpl::created();
     log4cplus::Logger logger = (name.empty()) ?
         log4cplus::Logger::getRoot() : log4cplus::Logger::getInstance(name);
+    if (created != LoggerImpl::created())
+    {
+        LoggerImpl::invalidateChains();
+    }
+
+    return slog::Logger::impl(logger);
+}
+
+static void setThreshold(LogSite& site)
+{
+    static const LogLevel levels[] = 
+    {
+        TRACE_LOG_LEVEL, DEBUG_LOG_LEVEL, INFO_LOG_LEVEL, 
+        WARN_LOG_LEVEL, ERROR_LOG_LEVEL, FATAL_LOG_LEVEL
+    };
+
+    site.level = site.logger->getChainedLogLevel();
+    site.disabled = ALL_LOG_LEVEL;
+    site.threshold = site.level;
+    if (site.logger->isEnabledFor(site.threshold))
+    {
+        return;
+    }
+
+    // Only the hierarchy rejects levels at or above the chained one.
+    site.disabled = site.threshold;
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++)
+    {
+        if (levels[i] > site.level)
+        {
+            if (site.logger->isEnabledFor(levels[i]))
+            {
+                site.threshold = levels[i];
+
+                return;
+            }
+            site.disabled = levels[i];
+        }
+    }
+
+    site.threshold = OFF_LOG_LEVEL + 1;
+}
+
+bool isLogSiteCurrent(const LogSite& site)
+{
+    Hierarchy& h = site.logger->getHierarchy();
+
+    return site.logger->getChainedLogLevel() == site.level
+        && (site.threshold > FATAL_LOG_LEVEL || !h.isDisabled(site.threshold))
+        && (site.disabled == ALL_LOG_LEVEL || h.isDisabled(site.disabled));
+}
+
+LogSite lookupLogSite(const std::string& name)
+{
+    LogSite site;
+    site.name = NULL;
+    site.logger = getLogger(name);
+    setThreshold(site);
+    site.generation = 0;
+
+    return site;
+}
+
+LogSite resolveLogSite(LogSite& site, const char* name)
+{
+    unsigned long gen = __atomic_load_n(&logGeneration, __ATOMIC_ACQUIRE);
+    LogSite resolved = lookupLogSite(name);
+    resolved.name = name;
+
+    unsigned long old = __atomic_load_n(&site.generation, __ATOMIC_RELAXED);
+    if (gen != 0 && old != kLogSiteBusy 
+        && __atomic_compare_exchange_n(&site.generation, &old, kLogSiteBusy, 
+            false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&site.name, name, __ATOMIC_RELAXED);
+        __atomic_store_n(&site.logger, resolved.logger, __ATOMIC_RELAXED);
+        __atomic_store_n(&site.threshold, resolved.threshold, __ATOMIC_RELAXED);
+        __atomic_store_n(&site.level, resolved.level, __ATOMIC_RELAXED);
+        __atomic_store_n(&site.disabled, resolved.disabled, __ATOMIC_RELAXED);
+        __atomic_store_n(&site.generation, gen, __ATOMIC_RELEASE);
+    }
+
+    return resolved;
+}
+
+void invalidateLogSites()
+{
+    __atomic_add_fetch(&logGeneration, 1, __ATOMIC_RELEASE);
+}
+
+static bool needLog(LoggerHandle logger, int level)
+{
+    return logger->isEnabledFor(level);
+}
+
+static LoggingEvent* getThreadEvent()
+{
+    static boost::thread_specific_ptr<LoggingEvent> events;
+    LoggingEvent* event = events.get();
+    if (NULL == event)
+    {
+        event = new LoggingEvent();
+        events.reset(event);
+    }
 
-    return logger.isEnabledFor(level);
+    return event;
 }
 
-static void LogAllStream(const std::string& name, int level, 
+static void LogAllStream(LoggerHandle logger, int level, 
     const std::string& message, const char* file, int line)
 {
-    log4cplus::Logger logger = (name.empty()) ?
-        log4cplus::Logger::getRoot() : log4cplus::Logger::getInstance(name);
-    logger.forcedLog(level, message, file, line);
+    AsyncLogger& async = slog::getAsyncLogger();
+    if (async.IsRunning() && async.Push(logger, level, message, file, line))
+    {
+        return;
+    }
+
+    LoggingEvent* event = getThreadEvent();
+    event->setLoggingEvent(logger->getName(), level, message, file, line);
+    logger->callAppenders(*event);
+}
+
+void logprintf(LoggerHandle logger, int level, const char* file, int line,
+    const char* format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+
+    AsyncLogger& async = slog::getAsyncLogger();
+    if (async.IsRunning() 
+        && async.PushDeferred(logger, level, file, line, format, ap))
+    {
+        va_end(ap);
+
+        return;
+    }
+
+    LoggingEvent* event = getThreadEvent();
+    event->setDeferredEvent(logger->getName(), level, file, line, format, ap);
+    va_end(ap);
+
+    event->renderMessage();
+    logger->callAppenders(*event);
 }
 
 logstream::logstream(const std::string& name, int level, 
     const char* file, int line)
-    : m_name(name)
+    : m_logger(getLogger(name))
+    , m_level(level)
+    , m_file(file)
+    , m_line(line) 
+    , m_enabled(needLog(m_logger, level))
+{
+}
+
+logstream::logstream(LoggerHandle logger, int level, 
+    const char* file, int line)
+    : m_logger(logger)
     , m_level(level)
     , m_file(file)
     , m_line(line) 
+    , m_enabled(true)
 {
 }
 
 logstream::~logstream()
 {
-    if (needLog(m_name, m_level)) 
+    if (m_enabled) 
     {
         logstream& ls = *this;
-        LogAllStream(m_name, m_level, ls.str(), m_file, m_line);
+        LogAllStream(m_logger, m_level, ls.str(), m_file, m_line);
     }
 }
 
@@ -10,9 +10,19 @@
 #include <string>
 #include <log4cplus/loglevel.h>
 
+namespace log4cplus
+{
+namespace spi
+{
+    class LoggerImpl;
+}
+}
+
 namespace slog 
 {
 
+typedef log4cplus::spi::LoggerImpl* LoggerHandle;
+
 enum Level 
 {
     SLOG_ALL   = log4cplus::ALL_LOG_LEVEL,
@@ -27,11 +37,84 @@ enum Level
 
 void sLogConfig(const std::string& file);
 
+// Name printed by %t for events logged from the calling thread, instead of
+// its numeric id.
+void setThreadName(const std::string& name);
+
+// Request scoped fields of the calling thread, printed by %X before the
+// log4cplus MDC. Setting an existing key replaces its value.
+void putContext(const std::string& key, const std::string& value);
+void removeContext(const std::string& key);
+void clearContext();
+
+// Per call site cache of the resolved logger and its effective level. It is
+// zero initialized as a function local static and revalidated against
+// logGeneration, which every configuration bumps. Levels changed at runtime
+// through log4cplus, Logger::setLogLevel() or Hierarchy::disable(), bump
+// nothing, so every use also compares the logger's chained level and the
+// hierarchy's disable threshold with those the site was resolved from. A
+// const char* name must keep its contents for as long as its address is in
+// use, names built at runtime should be std::string.
+struct LogSite
+{
+    const char* name;
+    LoggerHandle logger;
+    int threshold;
+    // The chained level, and the highest level below threshold that the
+    // hierarchy disabled or SLOG_ALL.
+    int level;
+    int disabled;
+    unsigned long generation;
+
+    bool isEnabledFor(int level) const
+    {
+        return NULL != logger && level >= threshold;
+    }
+};
+
+extern unsigned long logGeneration;
+
+LoggerHandle getLogger(const std::string& name);
+LogSite lookupLogSite(const std::string& name);
+LogSite resolveLogSite(LogSite& site, const char* name);
+bool isLogSiteCurrent(const LogSite& site);
+
+inline LogSite getLogSite(LogSite& site, const char* name)
+{
+    unsigned long gen = __atomic_load_n(&site.generation, __ATOMIC_ACQUIRE);
+    if (gen != 0 && gen == __atomic_load_n(&logGeneration, __ATOMIC_ACQUIRE))
+    {
+        LogSite copy;
+        copy.name = __atomic_load_n(&site.name, __ATOMIC_RELAXED);
+        copy.logger = __atomic_load_n(&site.logger, __ATOMIC_RELAXED);
+        copy.threshold = __atomic_load_n(&site.threshold, __ATOMIC_RELAXED);
+        copy.level = __atomic_load_n(&site.level, __ATOMIC_RELAXED);
+        copy.disabled = __atomic_load_n(&site.disabled, __ATOMIC_RELAXED);
+        copy.generation = gen;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (copy.name == name 
+            && gen == __atomic_load_n(&site.generation, __ATOMIC_RELAXED)
+            && isLogSiteCurrent(copy))
+        {
+            return copy;
+        }
+    }
+
+    return resolveLogSite(site, name);
+}
+
+inline LogSite getLogSite(LogSite&, const std::string& name)
+{
+    return lookupLogSite(name);
+}
+
 class logstream : public std::ostringstream 
 {
 public:
     logstream(const std::string& name, int level, 
         const char* file, int line);
+    logstream(LoggerHandle logger, int level, 
+        const char* file, int line);
     ~logstream();
 
     logstream& stream();
@@ -41,14 +124,58 @@ private:
     logstream& operator=(const logstream&);
 
 private:
-    std::string m_name;
+    LoggerHandle m_logger;
     int m_level;
     const char* m_file;
     int m_line;
+    bool m_enabled;
 };
 
+// printf style front end, the arguments are captured as raw values and the
+// text is rendered by the async backend thread when it is running. Only the
+// format pointer is kept, so it must be a string literal or otherwise
+// outlive the rendering; BinaryLayout also tells formats apart by address.
+void logprintf(LoggerHandle logger, int level, const char* file, int line,
+    const char* format, ...) __attribute__((format(printf, 5, 6)));
+
+#define SLOG_SITE(name) \
+    slog::getLogSite(*__extension__ ({ \
+        static slog::LogSite slog_static_site_; &slog_static_site_; }), name)
+
+// Statements below SLOG_MIN_LEVEL are compiled out, e.g. build release
+// binaries with -DSLOG_MIN_LEVEL=slog::SLOG_INFO to drop TRACE and DEBUG.
+#ifndef SLOG_MIN_LEVEL
+#define SLOG_MIN_LEVEL slog::SLOG_ALL
+#endif
+
+#define SLOG_COMPILED_IN(level) ((level) >= (SLOG_MIN_LEVEL))
+
+// True when a statement at this level would be logged, for guarding code
+// that only prepares log output.
+#define sLogEnabled(name, level) \
+    (SLOG_COMPILED_IN(level) && SLOG_SITE(name).isEnabledFor(level))
+
+// The level is checked against the cached threshold before the stream is
+// built, a disabled statement neither constructs it nor evaluates operands.
+// Both macros expand to a for statement, so sLog(...) << x; can only be
+// used as a statement, never inside an expression or with the comma
+// operator. It is safe as the body of an unbraced if, a following else
+// still binds to that if.
 #define sLog(name, level) \
-    slog::logstream(name, level, __FILE__, __LINE__).stream()
+    for (slog::LogSite slog_site_ = SLOG_COMPILED_IN(level) ? \
+            SLOG_SITE(name) : slog::LogSite(); \
+        SLOG_COMPILED_IN(level) && slog_site_.isEnabledFor(level); \
+        slog_site_.logger = NULL) \
+        slog::logstream(slog_site_.logger, level, \
+            __FILE__, __LINE__).stream()
+
+#define sLogf(name, level, ...) \
+    for (slog::LogSite slog_site_ = SLOG_COMPILED_IN(level) ? \
+            SLOG_SITE(name) : slog::LogSite(); \
+        SLOG_COMPILED_IN(level) && slog_site_.isEnabledFor(level); \
+        slog_site_.logger = NULL) \
+        slog::logprintf(slog_site_.logger, level, \
+            __FILE__, __LINE__, __VA_ARGS__)
 
 } // namespace slog
 
@@ -0,0 +1,368 @@
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <zlib.h>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef SLOG_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef SLOG_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "binary_layout.h"
+#include "block_index.h"
+#include "logging_event.h"
+#include "pattern_layout.h"
+
+using namespace std;
+
+namespace slog
+{
+    void initializeLog();
+}
+
+static void usage(const char* prog)
+{
+    cerr << "Usage: " << prog << " [-p pattern] [-b begin] [-e end] [-r] file..." << endl
+        << "Decode files written by BinaryLayout, oldest first." << endl
+        << "  -b, -e  only logs in this time window, \"YYYY-mm-dd HH:MM:SS\" or epoch seconds" << endl
+        << "  -r      print the text of the selected blocks instead of decoding them" << endl
+        << "Files ending in .gz, .zst or .lz4 are decompressed. With a " 
+        << slog::kBlockIndexSuffix 
+        << " index next to them, only blocks overlapping the window are read." << endl;
+}
+
+static bool parseTime(const char* text, int64_t* usec)
+{
+    struct tm time;
+    memset(&time, 0, sizeof(time));
+    const char* end = strptime(text, "%Y-%m-%d %H:%M:%S", &time);
+    if (end && *end == '\0')
+    {
+        time.tm_isdst = -1;
+        *usec = mktime(&time) * 1000000LL;
+
+        return true;
+    }
+
+    char* p = NULL;
+    long long sec = strtoll(text, &p, 10);
+    if (p == text || *p != '\0')
+    {
+        return false;
+    }
+    *usec = sec * 1000000LL;
+
+    return true;
+}
+
+static bool endsWith(const string& str, const string& suffix)
+{
+    return str.size() >= suffix.size() 
+        && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Inflates one or more concatenated gzip members.
+static bool inflateBlock(const char* data, size_t size, string& out)
+{
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, 15|16) != Z_OK)
+    {
+        return false;
+    }
+
+    char buf[64 << 10];
+    strm.next_in = (Bytef*)data;
+    strm.avail_in = size;
+    int ret = Z_OK;
+    do
+    {
+        strm.next_out = (Bytef*)buf;
+        strm.avail_out = sizeof(buf);
+        ret = inflate(&strm, Z_NO_FLUSH);
+        out.append(buf, sizeof(buf) - strm.avail_out);
+        if (ret == Z_STREAM_END)
+        {
+            if (strm.avail_in == 0)
+            {
+                break;
+            }
+            inflateReset(&strm);
+        }
+        else if (ret != Z_OK)
+        {
+            break;
+        }
+    } while (strm.avail_in > 0 || strm.avail_out == 0);
+    inflateEnd(&strm);
+
+    return ret == Z_STREAM_END;
+}
+
+#ifdef SLOG_HAVE_ZSTD
+// Decompresses one or more concatenated zstd frames.
+static bool decompressZstd(const char* data, size_t size, string& out)
+{
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    if (!dctx)
+    {
+        return false;
+    }
+
+    // CompressWindowLog may go up to the 64-bit limit.
+    ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax, 31);
+
+    char buf[64 << 10];
+    ZSTD_inBuffer in = { data, size, 0 };
+    ZSTD_outBuffer o = { buf, sizeof(buf), 0 };
+    size_t ret = 0;
+    do
+    {
+        o.pos = 0;
+        ret = ZSTD_decompressStream(dctx, &o, &in);
+        if (ZSTD_isError(ret))
+        {
+            break;
+        }
+        out.append(buf, o.pos);
+    } while (in.pos < in.size || o.pos == o.size);
+    ZSTD_freeDCtx(dctx);
+
+    return !ZSTD_isError(ret) && ret == 0;
+}
+#endif
+
+#ifdef SLOG_HAVE_LZ4
+// Decompresses one or more concatenated lz4 frames.
+static bool decompressLz4(const char* data, size_t size, string& out)
+{
+    LZ4F_dctx* dctx = NULL;
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)))
+    {
+        return false;
+    }
+
+    char buf[64 << 10];
+    size_t ret = 0;
+    size_t produced = 0;
+    do
+    {
+        size_t consumed = size;
+        produced = sizeof(buf);
+        ret = LZ4F_decompress(dctx, buf, &produced, data, &consumed, NULL);
+        if (LZ4F_isError(ret))
+        {
+            break;
+        }
+        out.append(buf, produced);
+        data += consumed;
+        size -= consumed;
+    } while (size > 0 || produced == sizeof(buf));
+    LZ4F_freeDecompressionContext(dctx);
+
+    return !LZ4F_isError(ret) && ret == 0;
+}
+#endif
+
+typedef bool (*BlockDecoder)(const char* data, size_t size, string& out);
+
+// How to decompress a file, NULL when it is plain or not supported by this
+// build, which *supported then tells apart.
+static BlockDecoder findDecoder(const string& name, bool* supported)
+{
+    *supported = true;
+    if (endsWith(name, ".gz"))
+    {
+        return inflateBlock;
+    }
+
+    if (endsWith(name, ".zst"))
+    {
+#ifdef SLOG_HAVE_ZSTD
+        return decompressZstd;
+#else
+        *supported = false;
+#endif
+    }
+
+    if (endsWith(name, ".lz4"))
+    {
+#ifdef SLOG_HAVE_LZ4
+        return decompressLz4;
+#else
+        *supported = false;
+#endif
+    }
+
+    return NULL;
+}
+
+static void printLogs(istream& input, const char* name, 
+    slog::BinaryLogReader& reader, slog::PatternLayout& layout, 
+    int64_t begin, int64_t end)
+{
+    slog::LoggingEvent event;
+    reader.Open(&input);
+    while (reader.Next(event))
+    {
+        const log4cplus::helpers::Time& t = event.getTimestamp();
+        int64_t usec = t.sec() * 1000000LL + t.usec();
+        if (usec >= begin && usec <= end)
+        {
+            layout.formatAndAppend(cout, event);
+        }
+    }
+
+    if (!input.eof())
+    {
+        cerr << "Truncated or corrupt record in " << name << endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    string pattern = "%D:%d{%q} [%-5p][%14t] <%F:%L> %c - %m%n";
+    int64_t begin = numeric_limits<int64_t>::min();
+    int64_t end = numeric_limits<int64_t>::max();
+    bool raw = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:b:e:rh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            pattern = optarg;
+            break;
+
+        case 'b':
+        case 'e':
+            if (!parseTime(optarg, opt == 'b' ? &begin : &end))
+            {
+                cerr << "Bad time: " << optarg << endl;
+
+                return 1;
+            }
+
+            // The end second is included.
+            if (opt == 'e')
+            {
+                end += 999999;
+            }
+            break;
+
+        case 'r':
+            raw = true;
+            break;
+
+        default:
+            usage(argv[0]);
+
+            return 1;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+
+        return 1;
+    }
+
+    slog::initializeLog();
+
+    slog::PatternLayout layout(pattern);
+    slog::BinaryLogReader reader;
+
+    for (int i = optind; i < argc; i++)
+    {
+        ifstream in(argv[i], ios::in | ios::binary);
+        if (!in)
+        {
+            cerr << "Unable to open file: " << argv[i] << endl;
+
+            return 1;
+        }
+
+        bool supported = true;
+        BlockDecoder decode = findDecoder(argv[i], &supported);
+        if (!supported)
+        {
+            cerr << "Build slogcat with WITH_ZSTD=1 or WITH_LZ4=1 to read " 
+                << argv[i] << endl;
+
+            return 1;
+        }
+
+        if (!decode)
+        {
+            if (raw)
+            {
+                cout << in.rdbuf();
+            }
+            else
+            {
+                printLogs(in, argv[i], reader, layout, begin, end);
+            }
+
+            continue;
+        }
+
+        // Whole file as a single block unless an index splits it.
+        vector<slog::BlockIndexEntry> index;
+        if (!slog::readBlockIndex(string(argv[i]) + slog::kBlockIndexSuffix, index))
+        {
+            in.seekg(0, ios::end);
+            slog::BlockIndexEntry whole = { 0, (uint64_t)in.tellg(), begin, end };
+            index.push_back(whole);
+        }
+
+        string block;
+        for (size_t j = 0; j < index.size(); j++)
+        {
+            if (index[j].last < begin || index[j].first > end)
+            {
+                continue;
+            }
+
+            block.resize(index[j].length);
+            in.seekg(index[j].offset);
+            if (index[j].length && !in.read(&block[0], index[j].length))
+            {
+                cerr << "Short read in " << argv[i] << endl;
+
+                break;
+            }
+
+            string text;
+            if (!decode(block.data(), block.size(), text))
+            {
+                cerr << "Corrupt block at offset " << index[j].offset 
+                    << " in " << argv[i] << endl;
+            }
+
+            if (raw)
+            {
+                cout.write(text.data(), text.size());
+            }
+            else
+            {
+                istringstream records(text);
+                printLogs(records, argv[i], reader, layout, begin, end);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include "time_util.h"
+
+#include <cstring>
+#include <vector>
+
+namespace slog
+{
+
+namespace
+{
+
+const time_t kOffsetPeriod = 15 * 60;
+
+struct UtcOffset
+{
+    time_t begin;
+    time_t end;
+    long offset;
+    int isdst;
+    const char* zone;
+};
+
+static __thread UtcOffset cachedOffset = { 0, 0, 0, 0, NULL };
+
+static time_t floorDiv(time_t a, time_t b)
+{
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+static const UtcOffset& getUtcOffset(time_t t)
+{
+    UtcOffset& cache = cachedOffset;
+    if (t < cache.begin || t >= cache.end)
+    {
+        struct tm local;
+        localtime_r(&t, &local);
+
+        cache.begin = floorDiv(t, kOffsetPeriod) * kOffsetPeriod;
+        cache.end = cache.begin + kOffsetPeriod;
+        cache.offset = local.tm_gmtoff;
+        cache.isdst = local.tm_isdst;
+        cache.zone = local.tm_zone;
+    }
+
+    return cache;
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date, month is 1..12.
+static time_t daysFromCivil(time_t y, int m, int d)
+{
+    y -= m <= 2;
+    time_t era = floorDiv(y, 400);
+    time_t yoe = y - era * 400;
+    time_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    time_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+static void civilFromDays(time_t z, time_t* y, int* m, int* d)
+{
+    z += 719468;
+    time_t era = floorDiv(z, 146097);
+    time_t doe = z - era * 146097;
+    time_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    time_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    time_t mp = (5 * doy + 2) / 153;
+
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = yoe + era * 400 + (*m <= 2);
+}
+
+} // namespace
+
+void breakDownTime(time_t t, struct tm* result, bool utc)
+{
+    memset(result, 0, sizeof(*result));
+    if (utc)
+    {
+        result->tm_zone = "GMT";
+    }
+    else
+    {
+        const UtcOffset& offset = getUtcOffset(t);
+        t += offset.offset;
+        result->tm_gmtoff = offset.offset;
+        result->tm_isdst = offset.isdst;
+        result->tm_zone = offset.zone;
+    }
+
+    time_t days = floorDiv(t, 86400);
+    time_t secs = t - days * 86400;
+
+    time_t year = 0;
+    civilFromDays(days, &year, &result->tm_mon, &result->tm_mday);
+    result->tm_mon -= 1;
+    result->tm_year = year - 1900;
+    result->tm_yday = days - daysFromCivil(year, 1, 1);
+    result->tm_wday = (days % 7 + 11) % 7;
+    result->tm_hour = secs / 3600;
+    result->tm_min = secs % 3600 / 60;
+    result->tm_sec = secs % 60;
+}
+
+time_t makeLocalTime(const struct tm* time)
+{
+    time_t year = time->tm_year + 1900 + floorDiv(time->tm_mon, 12);
+    int mon = time->tm_mon - floorDiv(time->tm_mon, 12) * 12;
+
+    time_t local = (daysFromCivil(year, mon + 1, 1) + time->tm_mday - 1) * 86400
+        + time->tm_hour * 3600 + time->tm_min * 60 + time->tm_sec;
+
+    // Use the offset in effect at the result, not at the guess.
+    time_t t = local - getUtcOffset(local - cachedOffset.offset).offset;
+
+    return local - getUtcOffset(t).offset;
+}
+
+std::string formatTime(const std::string& format, const struct tm& time)
+{
+    char buf[256];
+    size_t len = strftime(buf, sizeof(buf), format.c_str(), &time);
+    if (len > 0 || format.empty())
+    {
+        return std::string(buf, len);
+    }
+
+    std::vector<char> big(4096);
+    len = strftime(&big[0], big.size(), format.c_str(), &time);
+
+    return std::string(&big[0], len);
+}
+
+} // namespace slog
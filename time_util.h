@@ -0,0 +1,25 @@
+#ifndef TIME_UTIL_H
+#define TIME_UTIL_H
+
+#include <time.h>
+#include <string>
+
+namespace slog
+{
+
+// Calendar conversions that stay off the glibc timezone lock. Epoch
+// seconds are broken down arithmetically; only the UTC offset comes from
+// localtime_r. Each thread looks the offset up again when it crosses a
+// quarter hour, which is when DST transitions happen.
+void breakDownTime(time_t t, struct tm* result, bool utc);
+
+// Inverse of breakDownTime(t, result, false). Out of range fields are
+// normalized the way mktime() does; tm_isdst is ignored.
+time_t makeLocalTime(const struct tm* time);
+
+// strftime() into a string.
+std::string formatTime(const std::string& format, const struct tm& time);
+
+} // namespace slog
+
+#endif